@@ -19,7 +19,8 @@ enum ProgramState
 enum DeviceState
 {
 	ACCEPTING_COMMANDS,
-	DOWNLOADING_CODE
+	DOWNLOADING_CODE,
+	RECEIVING_FRAME
 };
 
 ProgramState programState = PROGRAM_STOPPED;
@@ -27,8 +28,30 @@ DeviceState deviceState = ACCEPTING_COMMANDS;
 
 byte diagnosticsOutputLevel = 0;
 
+// Sends a failure message if the reply confirmations are turned on
+
+void commandFailed(const __FlashStringHelper * message)
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(message);
+	}
+}
+
 long delayEndTime;
 
+// Time in microseconds that a program may run for each time round the 
+// loop. Statements are run until the time is used up or a statement 
+// waits for a delay or a move. At least one statement is always run, 
+// so a budget of zero runs one statement each time round.
+#define DEFAULT_PROGRAM_TIME_BUDGET 2000
+
+int programTimeBudget = DEFAULT_PROGRAM_TIME_BUDGET;
+
+// A command, or a line of a downloaded program, can be up to 
+// COMMAND_BUFFER_SIZE - 1 characters long followed by the terminator. 
+// A longer program line is rejected and reported with its line number, 
+// apart from a comment, which is cut short.
 #define COMMAND_BUFFER_SIZE 60
 
 // Set command terminator to CR
@@ -39,6 +62,36 @@ long delayEndTime;
 // This is the EOT character
 #define PROGRAM_TERMINATOR 0x00
 
+// Stored programs are compiled into bytecode as they are downloaded. 
+// Each statement is stored as:
+//   opcode - one more than the position of the command in the command table
+//   length - number of operand bytes that follow
+//   operands - the text after the command letters, with each integer 
+//              replaced by INTEGER_TOKEN and the value, low byte first
+// Jumps hold LABEL_TOKEN and the position of the label statement, found 
+// at the end of the download, followed by the name of the label. 
+// Labels and comments have opcodes of their own so that they can be found 
+// without the command table.
+// When a statement is fetched its integers are put straight into the 
+// command arguments and the target of a jump is kept, so the numbers are 
+// never decoded again. Each of them leaves a single token byte in the 
+// command buffer to show where it was, and the command is called directly 
+// from its opcode. A statement can hold at most MAX_COMMAND_ARGUMENTS 
+// integers.
+// The token bytes are below the printable characters, so they can never 
+// appear in downloaded text. They are only read as tokens while a stored 
+// statement runs, so a command from the host that contains them is read 
+// as text.
+
+#define INTEGER_TOKEN 0x01
+#define LABEL_TOKEN 0x02
+
+// target of a jump to a label that is not in the program
+#define UNRESOLVED_LABEL 0xFFFF
+
+#define OPCODE_LABEL 0xFE
+#define OPCODE_COMMENT 0xFF
+
 char programCommand[COMMAND_BUFFER_SIZE];
 char * commandPos;
 char * commandLimit;
@@ -46,10 +99,24 @@ char * bufferLimit;
 char * decodePos;
 char * decodeLimit;
 
+// Set while a stored statement runs, see exeuteProgramStatement
+bool decodingCompiledStatement = false;
+byte compiledValuesRead;
+uint16_t compiledLabelTarget;
+
 char remoteCommand[COMMAND_BUFFER_SIZE];
 char * remotePos;
 char * remoteLimit;
 
+void resetCommand()
+{
+#ifdef COMMAND_DEBUG
+	Serial.println(".**resetCommand");
+#endif
+	commandPos = programCommand;
+	bufferLimit = commandPos + COMMAND_BUFFER_SIZE;
+}
+
 ///////////////////////////////////////////////////////////
 /// Serial comms 
 ///////////////////////////////////////////////////////////
@@ -74,7 +141,7 @@ byte GetRawCh()
 int programCounter;
 
 // Start position of the code as stored in the EEPROM
-int programBase;
+int programBase = STORED_PROGRAM_OFFSET;
 
 // Write position when downloading and storing program code
 int programWriteBase;
@@ -85,34 +152,127 @@ int bufferWritePosition;
 // Checksum for the download
 byte downloadChecksum;
 
-// Dumps the program as stored in the EEPROM
+/////////////////////////////////////////////
+//
+//  Program cache
+//
+/////////////////////////////////////////////
 
-void dumpProgramFromEEPROM(int EEPromStart)
+// The interpreter reads the stored program a byte at a time, and each 
+// EEPROM read is a call that waits on the EEPROM. The program is read 
+// through a window held in SRAM instead. The window is filled from the 
+// position that missed, so a program that fits in it is read from the 
+// EEPROM once when it starts, and a longer one is read in runs as the 
+// window slides along it. The window is not filled past the end of the 
+// program, which is found when the labels are indexed.
+// The window size can be reduced at run time, down to zero to read the 
+// EEPROM directly. All writes to the program go through writeProgramByte, 
+// which keeps the window up to date.
+// The window is paid for in SRAM, so it is only built in when 
+// PROGRAM_CACHE_SIZE is defined as the number of bytes it can hold. 
+// 64 holds a short loop. Without it the program is read from the EEPROM.
+
+#ifndef PROGRAM_CACHE_SIZE
+#define PROGRAM_CACHE_SIZE 0
+#endif
+
+// position after the program terminator
+int programEnd = EEPROM_SIZE;
+
+#if PROGRAM_CACHE_SIZE > 0
+
+byte programCache[PROGRAM_CACHE_SIZE];
+int programCacheStart = 0;
+int programCacheLength = 0;
+int programCacheLimit = PROGRAM_CACHE_SIZE;
+
+//#define PROGRAM_CACHE_DEBUG
+
+void clearProgramCache()
 {
-	Serial.println(F("Current program: "));
+	programCacheLength = 0;
+}
 
-	char byte;
-	while (byte = EEPROM.read(EEPromStart++))
-	{
-		if (byte == STATEMENT_TERMINATOR)
-			Serial.println();
-		else
-			Serial.print(byte);
+void setProgramCacheLimit(int limit)
+{
+	if (limit < 0)
+		limit = 0;
 
-		if (byte == PROGRAM_TERMINATOR)
-		{
-			Serial.println(F("Reached end of program"));
-			break;
-		}
+	if (limit > PROGRAM_CACHE_SIZE)
+		limit = PROGRAM_CACHE_SIZE;
 
-		if (EEPromStart >= EEPROM_SIZE)
-		{
-			Serial.println(F("Reached end of eeprom"));
-			break;
-		}
-	}
+	programCacheLimit = limit;
+	clearProgramCache();
+}
+
+void fillProgramCache(int position)
+{
+	int length = programEnd - position;
+
+	if (length > programCacheLimit)
+		length = programCacheLimit;
+
+#ifdef PROGRAM_CACHE_DEBUG
+	Serial.print(F(".Program cache fill at: "));
+	Serial.print(position);
+	Serial.print(F(" length: "));
+	Serial.println(length);
+#endif
+
+	for (int i = 0; i < length; i++)
+		programCache[i] = EEPROM.read(position + i);
+
+	programCacheStart = position;
+	programCacheLength = length;
+}
+
+byte readProgramByte(int position)
+{
+	unsigned int offset = (unsigned int)(position - programCacheStart);
+
+	if (offset < (unsigned int)programCacheLength)
+		return programCache[offset];
+
+	if (programCacheLimit == 0 || position < 0 || position >= programEnd)
+		return EEPROM.read(position);
+
+	fillProgramCache(position);
+
+	return programCache[0];
+}
+
+void writeProgramByte(int position, byte b)
+{
+	if (!storeByteIntoEEPROM(b, position))
+		return;
+
+	unsigned int offset = (unsigned int)(position - programCacheStart);
+
+	if (offset < (unsigned int)programCacheLength)
+		programCache[offset] = b;
+}
+
+#else
+
+inline byte readProgramByte(int position)
+{
+	return EEPROM.read(position);
+}
+
+inline void writeProgramByte(int position, byte b)
+{
+	storeByteIntoEEPROM(b, position);
 }
 
+#endif
+
+// The compiler and the program listing use the command table, so they are 
+// further down this file
+bool compileStatement(char * text, byte length);
+void buildLabelIndex(int programPosition);
+byte resolveProgramLabels();
+void dumpProgramFromEEPROM(int EEPromStart);
+
 // Starts a program running at the given position
 
 void startProgramExecution(int programPosition)
@@ -126,6 +286,9 @@ void startProgramExecution(int programPosition)
 #endif
 		programCounter = programPosition;
 		programBase = programPosition;
+
+		buildLabelIndex(programPosition);
+
 		programState = PROGRAM_ACTIVE;
 	}
 }
@@ -204,6 +367,24 @@ void resetLineStorageState()
 	lineStoreState = LINE_START;
 }
 
+// Number of the line of the download being stored, counted from one 
+// for the line after the RM command
+int downloadLineNumber;
+
+// Sends a failure message for the line being stored if the reply 
+// confirmations are turned on
+
+void downloadFailed(const __FlashStringHelper * message)
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("RXFail line "));
+		Serial.print(downloadLineNumber);
+		Serial.print(F(": "));
+		Serial.println(message);
+	}
+}
+
 
 // Called to start the download of program code
 // each byte that arrives down the serial port is now stored in program memory
@@ -220,8 +401,10 @@ void startDownloadingCode(int downloadPosition)
 	deviceState = DOWNLOADING_CODE;
 
 	programWriteBase = downloadPosition;
+	downloadLineNumber = 0;
 
 	resetLineStorageState();
+	resetCommand();
 
 	startBusyPixel(128,128,128);
 
@@ -298,7 +481,10 @@ void storeReceivedByte(byte b)
 
 		// put the terminator on the end
 
-		storeByteIntoEEPROM(PROGRAM_TERMINATOR, programWriteBase++);
+		writeProgramByte(programWriteBase++, PROGRAM_TERMINATOR);
+
+		// now that all the labels are stored the jumps can be pointed at them
+		resolveProgramLabels();
 
 		if (diagnosticsOutputLevel & DUMP_DOWNLOADS)
 		{
@@ -314,6 +500,7 @@ void storeReceivedByte(byte b)
 		if (b == STATEMENT_TERMINATOR)
 		{
 			// Got a terminator, look for the command character
+			downloadLineNumber++;
 			lineStoreState = LINE_START;
 		}
 		break;
@@ -327,8 +514,14 @@ void storeReceivedByte(byte b)
 	{
 		// get here if we are storing or just got a line start
 
-		// if we get here we store the byte
-		storeByteIntoEEPROM(b, programWriteBase++);
+		// the line is assembled in the command buffer and compiled when 
+		// the terminator arrives. Lines too long for the buffer are lost, 
+		// see COMMAND_BUFFER_SIZE.
+		if (commandPos != bufferLimit)
+		{
+			*commandPos = b;
+			commandPos++;
+		}
 
 		if (diagnosticsOutputLevel & ECHO_DOWNLOADS)
 		{
@@ -342,6 +535,21 @@ void storeReceivedByte(byte b)
 			{
 				Serial.println();
 			}
+
+			downloadLineNumber++;
+
+			if (commandPos[-1] != STATEMENT_TERMINATOR && programCommand[0] == '#')
+			{
+				// keep as much of a long comment as fits
+				commandPos[-1] = STATEMENT_TERMINATOR;
+			}
+
+			if (commandPos[-1] == STATEMENT_TERMINATOR)
+				compileStatement(programCommand, commandPos - programCommand);
+			else
+				downloadFailed(F("line too long"));
+
+			resetCommand();
 			lineStoreState = LINE_START;
 			// look busy
 			updateBusyPixel();
@@ -350,6 +558,32 @@ void storeReceivedByte(byte b)
 
 }
 
+/////////////////////////////////////////////
+//
+//  Command arguments
+//
+/////////////////////////////////////////////
+
+// Most commands take a list of integers separated by commas. readArguments 
+// decodes them into commandArguments in one pass, so the commands do not 
+// each have to check for the terminator and skip the separators. 
+// Arguments that are not given are set from the defaults, or to zero if 
+// there are no defaults. The number of arguments actually given is returned 
+// so that a command can check the ones it must have.
+// When all the arguments have been read the decode position is left on the 
+// separator after the last one, so a command can go on to read a colour 
+// name or label.
+// The values are overwritten by the next call, so copy out any that are 
+// needed before reading more.
+
+#define MAX_COMMAND_ARGUMENTS 5
+
+struct CommandArguments
+{
+	byte count;
+	int values[MAX_COMMAND_ARGUMENTS];
+} commandArguments;
+
 #ifdef COMMAND_DEBUG
 #define READ_INTEGER_DEBUG
 #endif
@@ -362,6 +596,16 @@ int readInteger()
 	int sign = 1;
 	int result = 0;
 
+	if (decodingCompiledStatement && *decodePos == INTEGER_TOKEN)
+	{
+		// the values were put in the command arguments when the statement 
+		// was fetched and are read in order. readArguments writes the 
+		// values back as it reads them, which is safe because it never 
+		// writes past the value being read.
+		decodePos++;
+		return commandArguments.values[compiledValuesRead++];
+	}
+
 	if (*decodePos == '-')
 	{
 #ifdef READ_INTEGER_DEBUG
@@ -416,13 +660,36 @@ int readInteger()
 	return result;
 }
 
-void resetCommand()
+byte readArguments(byte maxArguments, const int * defaults)
 {
-#ifdef COMMAND_DEBUG
-	Serial.println(".**resetCommand");
-#endif
-	commandPos = programCommand;
-	bufferLimit = commandPos + COMMAND_BUFFER_SIZE;
+	int * values = commandArguments.values;
+	byte count = 0;
+
+	while (decodePos != decodeLimit && *decodePos != STATEMENT_TERMINATOR)
+	{
+		values[count++] = readInteger();
+
+		if (count == maxArguments || decodePos == decodeLimit || *decodePos == STATEMENT_TERMINATOR)
+			break;
+
+		// move past the separator
+		decodePos++;
+	}
+
+	commandArguments.count = count;
+
+	if (defaults == NULL)
+	{
+		for (byte i = count; i < maxArguments; i++)
+			values[i] = 0;
+	}
+	else
+	{
+		for (byte i = count; i < maxArguments; i++)
+			values[i] = defaults[i];
+	}
+
+	return count;
 }
 
 #ifdef COMMAND_DEBUG
@@ -434,47 +701,30 @@ void resetCommand()
 
 void remoteMoveForwards()
 {
-	int forwardMoveDistance;
-
 #ifdef MOVE_FORWARDS_DEBUG
 	Serial.println(".**moveForwards");
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("FAIL: no dist"));
-		}
-		return;
-	}
-		
-	forwardMoveDistance = readInteger();
+	byte count = readArguments(2, NULL);
+	int * args = commandArguments.values;
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 0)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.print(F("MFOK"));
-		}
-		fastMoveDistanceInMM(forwardMoveDistance, forwardMoveDistance);
+		commandFailed(F("FAIL: no dist"));
 		return;
 	}
 
-	decodePos++; // move past the separator
-
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 1)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println(F("FAIL: no time"));
+			Serial.print(F("MFOK"));
 		}
+		fastMoveDistanceInMM(args[0], args[0]);
 		return;
 	}
 
-	int forwardMoveTime = readInteger();
-
-	int moveResult = timedMoveDistanceInMM(forwardMoveDistance, forwardMoveDistance, (float)forwardMoveTime/10.0);
+	int moveResult = timedMoveDistanceInMM(args[0], args[0], (float)args[1]/10.0);
 
 	if (moveResult == 0)
 	{
@@ -485,10 +735,7 @@ void remoteMoveForwards()
 	}
 	else
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MFFail"));
-		}
+		commandFailed(F("MFFail"));
 	}
 }
 
@@ -507,40 +754,25 @@ void remoteMoveAngle()
 	Serial.println(".**moveAngle");
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MAFail: no radius"));
-		}
-		return;
-	}
-
-	int radius = readInteger();
+	byte count = readArguments(3, NULL);
+	int * args = commandArguments.values;
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 0)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MAFail: no angle"));
-		}
+		commandFailed(F("MAFail: no radius"));
 		return;
 	}
 
-	decodePos++;
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 1)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MAFail: no angle"));
-		}
+		commandFailed(F("MAFail: no angle"));
 		return;
 	}
 
-	int angle = readInteger();
+	int radius = args[0];
+	int angle = args[1];
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 2)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
@@ -550,18 +782,7 @@ void remoteMoveAngle()
 		return;
 	}
 
-	decodePos++;
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MAFail: no time"));
-		}
-		return;
-	}
-
-	int time = readInteger();
+	int time = args[2];
 
 #ifdef MOVE_ANGLE_DEBUG
 	Serial.print("    radius: ");
@@ -606,40 +827,25 @@ void remoteMoveMotors()
 	Serial.println(".**movemMotors");
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MMFail: no left distance"));
-		}
-		return ;
-	}
-
-	int leftDistance = readInteger();
+	byte count = readArguments(3, NULL);
+	int * args = commandArguments.values;
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 0)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MMFail: no right distance"));
-		}
+		commandFailed(F("MMFail: no left distance"));
 		return;
 	}
 
-	decodePos++;
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 1)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MMFail: no right distance"));
-		}
+		commandFailed(F("MMFail: no right distance"));
 		return;
 	}
 
-	int rightDistance = readInteger();
+	int leftDistance = args[0];
+	int rightDistance = args[1];
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 2)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
@@ -649,18 +855,7 @@ void remoteMoveMotors()
 		return;
 	}
 
-	decodePos++;
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MMFail: no time"));
-		}
-		return;
-	}
-
-	int time = readInteger();
+	int time = args[2];
 
 #ifdef MOVE_MOTORS_DEBUG
 	Serial.print("    ld: ");
@@ -706,60 +901,30 @@ void remoteConfigWheels()
 	Serial.println(F(".**remoteConfigWheels"));
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MWFail: no left diameter"));
-		}
-		return;
-	}
-
-	int leftDiameter = readInteger();
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MWFail: no right diameter"));
-		}
-		return;
-	}
-
-	decodePos++;
+	byte count = readArguments(3, NULL);
+	int * args = commandArguments.values;
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 0)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MWFail: no right diameter"));
-		}
+		commandFailed(F("MWFail: no left diameter"));
 		return;
 	}
 
-	int rightDiameter = readInteger();
-
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 1)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MWFail: no wheel spacing"));
-		}
+		commandFailed(F("MWFail: no right diameter"));
 		return;
 	}
 
-	decodePos++;
-
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count == 2)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MWFail: no wheel spacing"));
-		}
+		commandFailed(F("MWFail: no wheel spacing"));
 		return;
 	}
 
-	int spacing = readInteger();
+	int leftDiameter = args[0];
+	int rightDiameter = args[1];
+	int spacing = args[2];
 
 #ifdef CONFIG_WHEELS_DEBUG
 	Serial.print("    ld: ");
@@ -793,29 +958,27 @@ void remoteViewWheelConfig()
 
 void remoteRotateRobot()
 {
-	int rotateAngle;
-
 #ifdef ROTATE_DEBUG
 	Serial.println(F(".**rotateRobot"));
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	byte count = readArguments(2, NULL);
+	int * args = commandArguments.values;
+
+	if (count == 0)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MRFail: no angle"));
-		}
+		commandFailed(F("MRFail: no angle"));
 		return;
 	}
 
-	rotateAngle = readInteger();
+	int rotateAngle = args[0];
 	
 #ifdef ROTATE_DEBUG
 	Serial.print(".  Rotating: ");
 	Serial.println(rotateAngle);
 #endif
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (count == 1)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
@@ -825,20 +988,7 @@ void remoteRotateRobot()
 		return;
 	}
 
-	decodePos++; // move past the separator
-
-	if (*decodePos == STATEMENT_TERMINATOR)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MRFail: no time"));
-		}
-		return;
-	}
-
-	int rotateTimeInTicks = readInteger();
-
-	int moveResult = timedRotateRobot(rotateAngle, rotateTimeInTicks / 10.0);
+	int moveResult = timedRotateRobot(rotateAngle, args[1] / 10.0);
 
 	if (moveResult == 0)
 	{
@@ -849,10 +999,7 @@ void remoteRotateRobot()
 	}
 	else
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("MRFail"));
-		}
+		commandFailed(F("MRFail"));
 	}
 }
 
@@ -874,14 +1021,14 @@ void checkMoving()
 #ifdef CHECK_MOVING_DEBUG
 		Serial.println(".  moving");
 #endif
-		Serial.println("MCMove");
+		Serial.println(F("MCMove"));
 	}
 	else
 	{
 #ifdef CHECK_MOVING_DEBUG
 		Serial.println(".  stopped");
 #endif
-		Serial.println("MCstopped");
+		Serial.println(F("MCstopped"));
 	}
 }
 
@@ -901,121 +1048,74 @@ void remoteStopRobot()
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println("MSOK");
+		Serial.println(F("MSOK"));
 	}
 }
 
 
-void remoteMoveControl()
-{
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		Serial.println(F("FAIL: mising move control command character"));
-		return;
-	}
-
 #ifdef COMMAND_DEBUG
-	Serial.println(".**remoteMoveControl: ");
+#define PIXEL_COLOUR_DEBUG
 #endif
 
-	char commandCh = *decodePos;
+// Reads a colour name from the command and looks it up in the colour table
 
-#ifdef COMMAND_DEBUG
-	Serial.print(".  Move Command code : ");
-	Serial.println(commandCh);
-#endif
+bool readNamedColour(byte *r, byte *g, byte*b)
+{
+	int colourNo = findColourByName(decodePos);
 
-	decodePos++;
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.print(".  Colour number: ");
+	Serial.println(colourNo);
+#endif
 
-	switch (commandCh)
+	// move past the name
+	while (decodePos != decodeLimit &&
+		((*decodePos >= 'a' && *decodePos <= 'z') || (*decodePos >= 'A' && *decodePos <= 'Z')))
 	{
-	case 'A':
-	case 'a':
-		remoteMoveAngle();
-		break;
-	case 'F':
-	case 'f':
-		remoteMoveForwards();
-		break;
-	case 'R':
-	case 'r':
-		remoteRotateRobot();
-		break;
-	case 'M':
-	case 'm':
-		remoteMoveMotors();
-		break;
-	case 'C':
-	case 'c':
-		checkMoving();
-		break;
-	case 'S':
-	case 's':
-		remoteStopRobot();
-		break;
-	case 'V':
-	case 'v':
-		remoteViewWheelConfig();
-		break;
-	case 'W':
-	case 'w':
-		remoteConfigWheels();
-		break;
+		decodePos++;
 	}
-}
-
-#ifdef COMMAND_DEBUG
-#define PIXEL_COLOUR_DEBUG
-#endif
-
-bool readColour(byte *r, byte *g, byte*b)
-{
-	*r = readInteger();
-#ifdef PIXEL_COLOUR_DEBUG
-	Serial.print(".  Red: ");
-	Serial.println(*r);
-#endif
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (colourNo < 0)
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println(F("FAIL: mising colour values in readColor"));
+			Serial.println(F("FAIL: unknown colour name"));
 		}
 		return false;
 	}
 
-	decodePos++;
+	getColourFromTable(colourNo, r, g, b);
+	return true;
+}
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("FAIL: mising colours after red in readColor"));
-		}
-		return false;
-		}
+// Reads a colour from the command. The colour can be given as rrr,ggg,bbb 
+// or as the name of a colour in the colour table. 
 
-	*g = readInteger();
-#ifdef PIXEL_COLOUR_DEBUG
-	Serial.print(".  Green: ");
-	Serial.println(*g);
-#endif
+bool readColour(byte *r, byte *g, byte*b)
+{
+	if ((*decodePos >= 'a' && *decodePos <= 'z') || (*decodePos >= 'A' && *decodePos <= 'Z'))
+	{
+		return readNamedColour(r, g, b);
+	}
 
-	decodePos++;
+	byte count = readArguments(3, NULL);
 
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (count < 3)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("FAIL: mising colours after green in readColor"));
-		}
+		commandFailed(F("FAIL: mising colour values in readColor"));
 		return false;
 	}
 
-	*b = readInteger();
+	*r = commandArguments.values[0];
+	*g = commandArguments.values[1];
+	*b = commandArguments.values[2];
+
 #ifdef PIXEL_COLOUR_DEBUG
-	Serial.print(".  Blue: ");
+	Serial.print(".  Red: ");
+	Serial.print(*r);
+	Serial.print(" Green: ");
+	Serial.print(*g);
+	Serial.print(" Blue: ");
 	Serial.println(*b);
 #endif
 
@@ -1024,6 +1124,7 @@ bool readColour(byte *r, byte *g, byte*b)
 
 // Command PCrrr,ggg,bbb - set a coloured candle with the red, green 
 // and blue components as given
+// Command PCname - set a coloured candle using a colour name
 // Return OK
 
 void remoteColouredCandle()
@@ -1036,7 +1137,7 @@ void remoteColouredCandle()
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.print("PC");
+		Serial.print(F("PC"));
 	}
 
 	if (readColour(&r, &g, &b))
@@ -1049,6 +1150,13 @@ void remoteColouredCandle()
 	}
 }
 
+// Command PXsss,rrr,ggg,bbb,ccc - fade to a colour
+// sss - speed from 1 (slowest) to 20 (fastest)
+// The colour can be given as a name instead of rrr,ggg,bbb
+// ccc - optional curve for the fade
+//   0 - linear, 1 - ease in, 2 - ease out, 3 - ease in and out, 4 - exponential
+// Return OK
+
 //#define REMOTE_PIXEL_COLOR_FADE_DEBUG
 
 void remoteFadeToColor()
@@ -1057,7 +1165,9 @@ void remoteFadeToColor()
 	Serial.println(".**remoteFadeToColour: ");
 #endif
 
-	byte no = readInteger();
+	readArguments(1, NULL);
+
+	byte no = commandArguments.values[0];
 	if (no < 1)no = 1;
 	if (no > 20)no = 20;
 
@@ -1072,7 +1182,7 @@ void remoteFadeToColor()
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.print("PX");
+		Serial.print(F("PX"));
 	}
 
 	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
@@ -1093,7 +1203,16 @@ void remoteFadeToColor()
 
 	if (readColour(&r, &g, &b))
 	{
-		transitionToColor(no,r, g, b);
+		byte curve = curveLinear;
+
+		if (*decodePos == ',')
+		{
+			decodePos++;
+			readArguments(1, NULL);
+			curve = commandArguments.values[0];
+		}
+
+		transitionToColor(no, r, g, b, curve);
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
 			Serial.println(F("OK"));
@@ -1109,7 +1228,9 @@ void remoteSetFlickerSpeed()
 	Serial.println(".**remoteSetFlickerSpeed: ");
 #endif
 
-	byte no = readInteger();
+	readArguments(1, NULL);
+
+	byte no = commandArguments.values[0];
 
 #ifdef PIXEL_COLOUR_DEBUG
 	Serial.print(".  Setting: ");
@@ -1126,6 +1247,8 @@ void remoteSetFlickerSpeed()
 
 // PIppp,rrr,ggg,bbb
 // Set individual pixel colour
+// ppp is the number of the light, which starts on pixel ppp when 
+// there are as many lights as pixels
 
 void remoteSetIndividualPixel()
 {
@@ -1134,7 +1257,9 @@ void remoteSetIndividualPixel()
 	Serial.println(".**remoteSetIndividualPixel: ");
 #endif
 
-	byte no = readInteger();
+	readArguments(1, NULL);
+
+	byte no = commandArguments.values[0];
 #ifdef PIXEL_COLOUR_DEBUG
 	Serial.print(".  Setting: ");
 	Serial.println(no);
@@ -1144,7 +1269,7 @@ void remoteSetIndividualPixel()
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.print("PI");
+		Serial.print(F("PI"));
 	}
 
 	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
@@ -1156,6 +1281,15 @@ void remoteSetIndividualPixel()
 		return;
 	}
 
+	if (no >= NO_OF_LIGHTS)
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.println(F("Fail: no such light"));
+		}
+		return;
+	}
+
 	byte r, g, b;
 
 	if (readColour(&r, &g, &b))
@@ -1163,7 +1297,7 @@ void remoteSetIndividualPixel()
 		setLightColor(r, g, b, no);
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println("OK");
+			Serial.println(F("OK"));
 		}
 	}
 }
@@ -1172,7 +1306,7 @@ void remoteSetPixelsOff()
 {
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println("POOK");
+		Serial.println(F("POOK"));
 	}
 
 	setAllLightsOff();
@@ -1182,310 +1316,878 @@ void remoteSetRandomColors()
 {
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println("PROK");
+		Serial.println(F("PROK"));
 	}
 
 	randomiseLights();
 }
 
+// PAn - set how overlapping lights are blended
+// 0 - add the colours together
+// 1 - use the brightest colour
 
-void remotePixelControl()
+void remoteSetBlendMode()
 {
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	readArguments(1, NULL);
+
+	setLightBlendMode(commandArguments.values[0]);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println(F("FAIL: mising pixel control command character"));
-		return;
+		Serial.println(F("PAOK"));
 	}
+}
 
-#ifdef PIXEL_COLOUR_DEBUG
-	Serial.println(".**remotePixelControl: ");
-#endif
-
-	char commandCh = *decodePos;
+// PPbbb,mmm - set the power budget for the lights
+// bbb - most current the lights may draw, in milliamps, 0 for no limit
+// mmm - optional amount taken off the budget while the motors are running
+// Frames that would draw more are dimmed automatically
+// PP on its own reports the budget, the estimate for the last frame and 
+// the scale that was applied to it, where 256 is full brightness
 
-#ifdef PIXEL_COLOUR_DEBUG
-	Serial.print(".  Pixel Command code : ");
-	Serial.println(commandCh);
-#endif
+void remotePowerBudget()
+{
+	int defaults[] = { 0, (int)motorPowerAllowance };
+
+	if (readArguments(2, defaults) == 0)
+	{
+		Serial.print(F("PP"));
+		Serial.print(lightPowerBudget);
+		Serial.print(',');
+		Serial.print(motorPowerAllowance);
+		Serial.print(',');
+		Serial.print(frameMilliamps);
+		Serial.print(',');
+		Serial.println(framePowerScale);
+		return;
+	}
 
-	decodePos++;
+	setLightPowerBudget((unsigned int)commandArguments.values[0], (unsigned int)commandArguments.values[1]);
 
-	switch (commandCh)
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-	case 'i':
-	case 'I':
-		remoteSetIndividualPixel();
-		break;
-	case 'o':
-	case 'O':
-		remoteSetPixelsOff();
-		break;
-	case 'c':
-	case 'C':
-		remoteColouredCandle();
-		break;
-	case 'f':
-	case 'F':
-		remoteSetFlickerSpeed();
-		break;
-	case 'x':
-	case 'X':
-		remoteFadeToColor();
-		break;
-	case 'r':
-	case 'R':
-		remoteSetRandomColors();
-		break;
+		Serial.println(F("PPOK"));
 	}
 }
 
-// Command CDddd - delay time
-// Command CD    - previous delay
-// Return OK
-
-#ifdef COMMAND_DEBUG
-#define COMMAND_DELAY_DEBUG
-#endif
+// PLn - set the light mode
+// 0 - manual, the lights are set by pixel commands
+// 1 - motion, the lights show what the motors are doing
+// 2 - proximity, the lights show the distance sensor reading
+// PL2,nnn,fff - proximity with the near and far distances in cm
+// Any pixel command that sets the lights returns to manual
 
-void remoteDelay()
+void remoteLightMode()
 {
-	int delayValueInTenthsIOfASecond;
+	int defaults[] = { lightModeManual, PROXIMITY_DEFAULT_NEAR, PROXIMITY_DEFAULT_FAR };
 
-#ifdef COMMAND_DELAY_DEBUG
-	Serial.println(".**remoteDelay");
-#endif
+	readArguments(3, defaults);
+
+	int * args = commandArguments.values;
+
+	byte mode = args[0];
 
-	if (*decodePos == STATEMENT_TERMINATOR)
+	if (mode == lightModeProximity)
 	{
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.println(F("CDFail: no delay"));
-		}
-		return;
+		setProximityRange(args[1], args[2]);
 	}
 
-	delayValueInTenthsIOfASecond = readInteger();
-
-#ifdef COMMAND_DELAY_DEBUG
-	Serial.print(".  Delaying: ");
-	Serial.println(delayValueInTenthsIOfASecond);
-#endif
+	if (!setLightMode(mode))
+	{
+		commandFailed(F("PLFail: unknown mode"));
+		return;
+	}
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.print(F("CDOK"));
+		Serial.println(F("PLOK"));
 	}
-
-	delayEndTime = millis() + delayValueInTenthsIOfASecond * 100;
-
-	programState = PROGRAM_AWAITING_DELAY_COMPLETION;
 }
 
-// Command CLxxxx - program label
-// Ignored at execution, specifies the destination of a branch
-// Return OK
+// PGn - turn gamma correction on (1) or off (0)
+// With gamma correction off the colours are sent to the strip as they 
+// are set, which matches older versions of the firmware
 
-void declareLabel()
+void remoteGammaCorrection()
 {
-#ifdef COMMAND_DELAY_DEBUG
-	Serial.println(".**declareLabel");
-#endif
+	readArguments(1, NULL);
+
+	setGammaCorrection(commandArguments.values[0] != 0);
 
 	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-		Serial.println("CLOK");
+		Serial.println(F("PGOK"));
 	}
 }
 
-int findNextStatement(int programPosition)
+// PSn - select the segment that the pixel commands work on
+// PSn,iii - also set the time between frames for the segment in ms
+// The segments are numbered from 0 along the strip
+
+void remoteSelectSegment()
 {
+	byte count = readArguments(2, NULL);
 
-	while (true)
+	if (!selectSegment(commandArguments.values[0]))
 	{
-		char ch = EEPROM.read(programPosition);
+		commandFailed(F("PSFail: no segment"));
+		return;
+	}
 
-		if (ch == PROGRAM_TERMINATOR | programPosition == EEPROM_SIZE)
-			return -1;
+	if (count > 1)
+	{
+		setSegmentTickInterval(commandArguments.values[1]);
+	}
 
-		if (ch == STATEMENT_TERMINATOR)
-		{
-			programPosition++;
-			if (programPosition == EEPROM_SIZE)
-				return -1;
-			else
-				return programPosition;
-		}
-		programPosition++;
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("PSOK"));
 	}
 }
 
-// Find a label in the program
-// Returns the offset into the program where the label is declared
-// The first parameter is the first character of the label 
-// (i.e. the character after the instruction code that specifies the destination)
-// This might not always be the same command (it might be a branch or a subroutine call)
-// The second parameter is the start position of the search in the program. 
-// This is always the start of a statement, and usually the start of the program, to allow
-// branches up the code. 
-
-//#define FIND_LABEL_IN_PROGRAM_DEBUG
+// PEppp,ppp.. - split the strip into segments at the given pixels
+// PE on its own puts the whole strip back into one segment
+// Segment 0 is selected and the light mode goes back to manual
 
-int findLabelInProgram(char * label, int programPosition)
+void remoteSplitSegments()
 {
-	// Assume we are starting at the beginning of the program
+	byte noOfEdges = readArguments(NO_OF_SEGMENTS - 1, NULL);
 
-	while (true)
+	if (*decodePos != STATEMENT_TERMINATOR & decodePos != decodeLimit)
 	{
-		// Spin down the statements
+		commandFailed(F("PEFail: too many segments"));
+		return;
+	}
 
-		int statementStart = programPosition;
+	byte edges[NO_OF_SEGMENTS - 1];
 
-		char programByte = EEPROM.read(programPosition++);
+	for (byte i = 0; i < noOfEdges; i++)
+		edges[i] = commandArguments.values[i];
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-		Serial.print("Statement at: ");
-		Serial.print(statementStart);
-		Serial.print(" starting: ");
-		Serial.println(programByte);
-#endif
-		if (programByte != 'C' & programByte != 'c')
-		{
+	if (!splitSegments(edges, noOfEdges))
+	{
+		commandFailed(F("PEFail: invalid split"));
+		return;
+	}
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("Not a statement that starts with C");
-#endif
+	lightMode = lightModeManual;
 
-			programPosition = findNextStatement(programPosition);
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("PEOK"));
+	}
+}
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Spin to statement at: ");
-			Serial.println(programPosition);
+#if NO_OF_SEGMENTS > MAX_COMMAND_ARGUMENTS + 1
+#error "PE can only split the strip into MAX_COMMAND_ARGUMENTS + 1 segments"
 #endif
 
-			// Check to see if we have reached the end of the program in EEPROM
-			if (programPosition == -1)
-			{
-				// Give up if the end of the code has been reached
-				return -1;
-			}
-			else
-			{
-				// Check this statement
-				continue;
-			}
-		}
+// PMmmm,ddd,sss,lll,hhh - set the lights moving
+// mmm - 0 to wrap round, 1 to bounce at the ends
+// ddd - distance moved each time, there are 32 steps between each pixel
+// sss - number of ticks between each move
+// lll,hhh - optional lowest and highest pixels for the movement
+// A single light with PM1 makes a scanner, and with PM0 a spinner
+// PM0,0,0 stops the lights moving
 
-		// If we get here we have found a C
+void remoteMoveLights()
+{
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.println(".**remoteMoveLights: ");
+#endif
 
-		programByte = EEPROM.read(programPosition++);
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("PM"));
+	}
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
+	byte count = readArguments(5, NULL);
+	int * args = commandArguments.values;
 
-		Serial.print("Second statement character: ");
-		Serial.println(programByte);
+	if (count == 0)
+	{
+		commandFailed(F("Fail: mising mode"));
+		return;
+	}
 
-#endif
+	if (count == 1)
+	{
+		commandFailed(F("Fail: mising distance"));
+		return;
+	}
 
-		// if we get here we have a control command - see if the command is a label
-		if (programByte != 'L' & programByte != 'l')
-		{
+	if (count == 2)
+	{
+		commandFailed(F("Fail: mising speed"));
+		return;
+	}
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("Not a loop command");
-#endif
+	moveLights(args[0], args[1], args[2], args[3], args[4]);
 
-			programPosition = findNextStatement(programPosition);
-			if (programPosition == -1)
-			{
-				return -1;
-			}
-			else
-			{
-				continue;
-			}
-		}
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("OK"));
+	}
+}
 
-		//if we get here we have a CL command
+// PNname - set all the lights to the named colour
+// PNddd  - set all the lights to colour ddd in the colour table
+// Colours 0 to 12 are the robot colours in lightColor order: red, blue, 
+// green, lilac, cyan, pink, lavender, plum, lime, orange, powderblue, 
+// purple and teal. The web colours follow if FULL_COLOUR_TABLE is defined.
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-		Serial.println("Got a CL command");
+void remoteNamedColour()
+{
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.println(".**remoteNamedColour: ");
 #endif
 
-		// Set start position for label comparison
-		char * labelTest = label;
-
-		// Now spin down the label looking for a match
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("PN"));
+	}
 
-		while (*labelTest != STATEMENT_TERMINATOR & programPosition < EEPROM_SIZE)
+	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			programByte = EEPROM.read(programPosition);
+			Serial.println(F("Fail: mising colour"));
+		}
+		return;
+	}
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Destination byte: ");
-			Serial.print(*labelTest);
-			Serial.print(" Program byte: ");
-			Serial.println(programByte);
-#endif
+	byte r, g, b;
 
-			if (*labelTest == programByte)
-			{
+	if ((*decodePos >= '0' && *decodePos <= '9') ||
+		(decodingCompiledStatement && *decodePos == INTEGER_TOKEN))
+	{
+		readArguments(1, NULL);
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-				Serial.println("Got a match");
-#endif
-				// Move on to the next byte
-				labelTest++;
-				programPosition++;
-			}
-			else
+		if (!getColourFromTable(commandArguments.values[0], &r, &g, &b))
+		{
+			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 			{
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-				Serial.println("Fail");
-#endif
-				break;
+				Serial.println(F("Fail: no such colour"));
 			}
+			return;
 		}
+	}
+	else
+	{
+		if (!readNamedColour(&r, &g, &b))
+			return;
+	}
 
-		// get here when we reach the end of the statement or we have a mismatch
-
-		// Get the byte at the end of the destination statement
+	steadyColouredLights(r, g, b);
 
-		programByte = EEPROM.read(programPosition);
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("OK"));
+	}
+}
 
-		if (*labelTest == programByte)
-		{
-			// If the end of the label matches the end of the statement code we have a match
-			// Note that this means that if the last line of the program is a label we can only 
-			// find this line if it has a statement terminator on the end. 
-			// Which is fine by me. 
+// PHddd,sss,vvv,uuu
+// Set all the lights to a hue, saturation and value
+// ddd is the hue in degrees, sss and vvv range from 0 to 255
+// uuu is optional. If given the hue moves round the colour wheel 
+// by this amount on each tick
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.println("label match");
+void remoteHueColour()
+{
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.println(".**remoteHueColour: ");
 #endif
-			return statementStart;
-		}
-		else
-		{
-			programPosition = findNextStatement(programPosition);
 
-#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
-			Serial.print("Spin to statement at: ");
-			Serial.println(programPosition);
-#endif
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("PH"));
+	}
 
-			// Check to see if we have reached the end of the program in EEPROM
-			if (programPosition == -1)
-			{
-				// Give up if the end of the code has been reached
-				return -1;
-			}
+	byte count = readArguments(4, NULL);
+	int * args = commandArguments.values;
+
+	if (count == 0)
+	{
+		commandFailed(F("Fail: mising hue"));
+		return;
+	}
+
+	if (count == 1)
+	{
+		commandFailed(F("Fail: mising saturation"));
+		return;
+	}
+
+	if (count == 2)
+	{
+		commandFailed(F("Fail: mising value"));
+		return;
+	}
+
+	hueColouredLights(hueFromDegrees(args[0]), args[1], args[2], args[3], 1);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("OK"));
+	}
+}
+
+// PWuuu,vvv
+// Spread a rainbow along the lights
+// uuu is the hue step on each tick, which makes the rainbow chase round the ring
+// vvv is optional and gives the brightness of the rainbow (default 255)
+
+void remoteRainbow()
+{
+#ifdef PIXEL_COLOUR_DEBUG
+	Serial.println(".**remoteRainbow: ");
+#endif
+
+	int defaults[] = { 0, 255 };
+
+	readArguments(2, defaults);
+
+	rainbowLights(255, commandArguments.values[1], commandArguments.values[0], 1);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("PWOK"));
+	}
+}
+
+
+// PB - binary frame upload
+// The command is followed by a binary packet that sets every pixel:
+//   count - number of pixels in the frame (at most PIXELS)
+//   r,g,b - three bytes for each pixel, starting at pixel 0
+//   checksum - low byte of the sum of all the bytes before it
+// Return PBOK when the frame is shown, PBFail if it is rejected
+//
+// PD - binary delta frame update
+// The command is followed by a binary packet that only sets the pixels 
+// that have changed since the last frame:
+//   runs - number of runs in the packet
+//   for each run:
+//     start - first pixel in the run
+//     length - number of pixels in the run (1-127). If the top bit is set 
+//              the run is a single colour and only one r,g,b follows
+//     r,g,b - colour bytes for the run
+//   checksum - low byte of the sum of all the bytes before it
+// Return PDOK when the frame is shown, PDFail if it is rejected
+//
+// In both cases the pixels are written straight into the strip as they 
+// arrive and the frame is shown when the checksum matches. The frame 
+// stays up until a light command is received.
+// A light mode would draw over the frame, in whichever segment it runs, 
+// so the upload stops it. Set the mode again with PL after the frames.
+// A packet that is found to be bad part way through is reported at once, 
+// and the rest of it is thrown away before any more commands are read. 
+// A PB packet is thrown away to its checksum. The length of a bad PD 
+// packet is not known, so the host must wait FRAME_BYTE_TIMEOUT_MILLIS 
+// after PDFail before sending anything else.
+
+// Time allowed between bytes of the frame before the upload is abandoned
+#define FRAME_BYTE_TIMEOUT_MILLIS 250
+
+// Top bit of a run length marks a run of one colour
+#define FRAME_RUN_SINGLE_COLOUR 0x80
+
+enum FrameReceiveState
+{
+	FRAME_AWAITING_COUNT,
+	FRAME_AWAITING_RUN_COUNT,
+	FRAME_AWAITING_RUN_START,
+	FRAME_AWAITING_RUN_LENGTH,
+	FRAME_RECEIVING_PIXELS,
+	FRAME_AWAITING_CHECKSUM,
+	FRAME_DISCARDING
+};
+
+FrameReceiveState frameReceiveState;
+
+// B for a full frame, D for a delta frame
+char frameCommand;
+
+byte frameRunsRemaining;
+byte framePixelsRemaining;
+bool frameRunSingleColour;
+byte framePixel;
+byte frameChannel;
+byte frameColour[3];
+byte frameChecksum;
+unsigned long frameLastByteTime;
+
+// Bytes still to be thrown away after a bad packet, zero if the length 
+// is not known
+unsigned int frameDiscardRemaining;
+
+void endFrameReceive()
+{
+	deviceState = ACCEPTING_COMMANDS;
+}
+
+// Reports the failure and puts the lights back on the strip
+
+void reportFrameFailure(const __FlashStringHelper * reason)
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print('P');
+		Serial.print(frameCommand);
+		Serial.print(F("Fail: "));
+		Serial.println(reason);
+	}
+	setAllSegmentsChanged();
+}
+
+// Used when the whole packet has arrived, or the host has stopped sending
+
+void frameReceiveFailed(const __FlashStringHelper * reason)
+{
+	reportFrameFailure(reason);
+	endFrameReceive();
+}
+
+// Used when a packet is found to be bad part way through. The rest of it 
+// is thrown away, so that none of the pixel data can be taken for commands. 
+// Bytes are discarded until the given number have arrived or, if the 
+// number is not known, until the host has been quiet for 
+// FRAME_BYTE_TIMEOUT_MILLIS. Commands are accepted again after that.
+
+void frameReceiveRejected(const __FlashStringHelper * reason, unsigned int bytesToDiscard)
+{
+	reportFrameFailure(reason);
+	frameDiscardRemaining = bytesToDiscard;
+	frameReceiveState = FRAME_DISCARDING;
+}
+
+void startFrameReceive(char command, FrameReceiveState startState)
+{
+	frameCommand = command;
+
+	if (deviceState != ACCEPTING_COMMANDS)
+	{
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.print('P');
+			Serial.print(frameCommand);
+			Serial.println(F("Fail: not accepting commands"));
+		}
+		return;
+	}
+
+	stopAllLightModes();
+	startRawFrame();
+
+	frameReceiveState = startState;
+	frameChecksum = 0;
+	frameLastByteTime = millis();
+	deviceState = RECEIVING_FRAME;
+}
+
+void remoteFrameUpload()
+{
+	startFrameReceive('B', FRAME_AWAITING_COUNT);
+}
+
+void remoteDeltaFrameUpload()
+{
+	startFrameReceive('D', FRAME_AWAITING_RUN_COUNT);
+}
+
+// Moves on to the next run, or the checksum if there are no more
+
+void nextFrameRun()
+{
+	if (frameRunsRemaining == 0)
+		frameReceiveState = FRAME_AWAITING_CHECKSUM;
+	else
+		frameReceiveState = FRAME_AWAITING_RUN_START;
+}
+
+void receiveFrameByte(byte b)
+{
+	frameLastByteTime = millis();
+
+	if (frameReceiveState == FRAME_DISCARDING)
+	{
+		if (frameDiscardRemaining > 0 && --frameDiscardRemaining == 0)
+			endFrameReceive();
+		return;
+	}
+
+	if (frameReceiveState != FRAME_AWAITING_CHECKSUM)
+		frameChecksum += b;
+
+	switch (frameReceiveState)
+	{
+	case FRAME_AWAITING_COUNT:
+		// a full frame is a single run starting at pixel 0
+		if (b > PIXELS)
+		{
+			// the pixels and the checksum are still to come
+			frameReceiveRejected(F("too many pixels"), (unsigned int)b * 3 + 1);
+			return;
+		}
+		frameRunsRemaining = 0;
+		framePixel = 0;
+		framePixelsRemaining = b;
+		frameRunSingleColour = false;
+		frameChannel = 0;
+		if (framePixelsRemaining == 0)
+			frameReceiveState = FRAME_AWAITING_CHECKSUM;
+		else
+			frameReceiveState = FRAME_RECEIVING_PIXELS;
+		break;
+
+	case FRAME_AWAITING_RUN_COUNT:
+		frameRunsRemaining = b;
+		nextFrameRun();
+		break;
+
+	case FRAME_AWAITING_RUN_START:
+		if (b >= PIXELS)
+		{
+			frameReceiveRejected(F("bad run start"), 0);
+			return;
+		}
+		framePixel = b;
+		frameReceiveState = FRAME_AWAITING_RUN_LENGTH;
+		break;
+
+	case FRAME_AWAITING_RUN_LENGTH:
+		frameRunSingleColour = (b & FRAME_RUN_SINGLE_COLOUR) != 0;
+		framePixelsRemaining = b & ~FRAME_RUN_SINGLE_COLOUR;
+		if (framePixelsRemaining == 0 || framePixelsRemaining > PIXELS - framePixel)
+		{
+			frameReceiveRejected(F("bad run length"), 0);
+			return;
+		}
+		frameRunsRemaining--;
+		frameChannel = 0;
+		frameReceiveState = FRAME_RECEIVING_PIXELS;
+		break;
+
+	case FRAME_RECEIVING_PIXELS:
+		frameColour[frameChannel++] = b;
+		if (frameChannel < 3)
+			break;
+
+		frameChannel = 0;
+
+		if (frameRunSingleColour)
+		{
+			while (framePixelsRemaining > 0)
+			{
+				setRawPixel(framePixel++, frameColour[0], frameColour[1], frameColour[2]);
+				framePixelsRemaining--;
+			}
+		}
+		else
+		{
+			setRawPixel(framePixel++, frameColour[0], frameColour[1], frameColour[2]);
+			framePixelsRemaining--;
+		}
+
+		if (framePixelsRemaining == 0)
+			nextFrameRun();
+		break;
+
+	case FRAME_AWAITING_CHECKSUM:
+		if (b != frameChecksum)
+		{
+			frameReceiveFailed(F("checksum"));
+			return;
+		}
+		showRawFrame();
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.print('P');
+			Serial.print(frameCommand);
+			Serial.println(F("OK"));
+		}
+		endFrameReceive();
+		break;
+	}
+}
+
+// Abandons a frame upload if the host stops sending part way through
+
+void checkFrameReceiveTimeout()
+{
+	if (deviceState != RECEIVING_FRAME)
+		return;
+
+	if (millis() - frameLastByteTime > FRAME_BYTE_TIMEOUT_MILLIS)
+	{
+		// the end of a rejected packet has already been reported
+		if (frameReceiveState == FRAME_DISCARDING)
+			endFrameReceive();
+		else
+			frameReceiveFailed(F("timeout"));
+	}
+}
+
+
+// Command CDddd - delay time
+// Command CD    - previous delay
+// Return OK
+
+#ifdef COMMAND_DEBUG
+#define COMMAND_DELAY_DEBUG
+#endif
+
+void remoteDelay()
+{
+#ifdef COMMAND_DELAY_DEBUG
+	Serial.println(".**remoteDelay");
+#endif
+
+	if (readArguments(1, NULL) == 0)
+	{
+		commandFailed(F("CDFail: no delay"));
+		return;
+	}
+
+	int delayValueInTenthsIOfASecond = commandArguments.values[0];
+
+#ifdef COMMAND_DELAY_DEBUG
+	Serial.print(".  Delaying: ");
+	Serial.println(delayValueInTenthsIOfASecond);
+#endif
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.print(F("CDOK"));
+	}
+
+	delayEndTime = millis() + delayValueInTenthsIOfASecond * 100;
+
+	programState = PROGRAM_AWAITING_DELAY_COMPLETION;
+}
+
+// Command CLxxxx - program label
+// Ignored at execution, specifies the destination of a branch
+// Return OK
+
+void declareLabel()
+{
+#ifdef COMMAND_DELAY_DEBUG
+	Serial.println(".**declareLabel");
+#endif
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CLOK"));
+	}
+}
+
+// Returns the position of the statement after the one at programPosition, 
+// or -1 if there are no more statements
+
+int findNextStatement(int programPosition)
+{
+	if (programPosition + 1 >= EEPROM_SIZE || readProgramByte(programPosition) == PROGRAM_TERMINATOR)
+		return -1;
+
+	programPosition += 2 + readProgramByte(programPosition + 1);
+
+	if (programPosition >= EEPROM_SIZE)
+		return -1;
+
+	return programPosition;
+}
+
+// Returns true if the label statement at programPosition declares the 
+// label, which ends with a statement terminator
+
+bool labelMatches(char * label, int programPosition)
+{
+	byte length = readProgramByte(programPosition + 1);
+	int namePosition = programPosition + 2;
+	byte i;
+
+	for (i = 0; i < length; i++)
+	{
+		if (label[i] != (char)readProgramByte(namePosition + i))
+			return false;
+	}
+
+	return label[i] == STATEMENT_TERMINATOR;
+}
+
+/////////////////////////////////////////////
+//
+//  Label index
+//
+/////////////////////////////////////////////
+
+// The labels in the stored program are indexed in RAM by a hash of their 
+// names, so finding a label does not mean walking the program. The index 
+// is built when a program is downloaded or started. A hash match is checked 
+// against the name in the program, so two labels with the same hash are 
+// still told apart. A program with more labels than the index can hold 
+// is searched for the ones that would not fit.
+// Jumps in a stored program hold the position of their label once it has 
+// been downloaded, so the index only speeds up the download and jumps sent 
+// by the host. Each entry takes four bytes of SRAM, so the index is only 
+// built in when MAX_PROGRAM_LABELS is defined. The program is still walked 
+// when it starts, to find where it ends.
+
+#ifndef MAX_PROGRAM_LABELS
+#define MAX_PROGRAM_LABELS 0
+#endif
+
+#if MAX_PROGRAM_LABELS > 0
+
+struct LabelEntry
+{
+	uint16_t hash;
+	int position;
+};
+
+struct LabelEntry labelIndex[MAX_PROGRAM_LABELS];
+byte noOfIndexedLabels = 0;
+bool labelIndexComplete = false;
+int labelIndexBase = -1;
+
+#endif
+
+inline uint16_t hashLabelChar(uint16_t hash, char ch)
+{
+	return (hash << 5) + hash + (byte)ch;
+}
+
+#define LABEL_HASH_START 5381
+
+//#define LABEL_INDEX_DEBUG
+
+void buildLabelIndex(int programPosition)
+{
+#if MAX_PROGRAM_LABELS > 0
+	noOfIndexedLabels = 0;
+	labelIndexComplete = true;
+	labelIndexBase = programPosition;
+#endif
+
+	while (programPosition >= 0)
+	{
+#if MAX_PROGRAM_LABELS > 0
+		if (readProgramByte(programPosition) == OPCODE_LABEL)
+		{
+			if (noOfIndexedLabels < MAX_PROGRAM_LABELS)
+			{
+				byte length = readProgramByte(programPosition + 1);
+				uint16_t hash = LABEL_HASH_START;
+
+				for (byte i = 0; i < length; i++)
+					hash = hashLabelChar(hash, (char)readProgramByte(programPosition + 2 + i));
+
+				labelIndex[noOfIndexedLabels].hash = hash;
+				labelIndex[noOfIndexedLabels].position = programPosition;
+				noOfIndexedLabels++;
+			}
 			else
 			{
-				// Check this statement
-				continue;
+				// carry on to find the end of the program
+				labelIndexComplete = false;
+			}
+		}
+#endif
+
+		int nextPosition = findNextStatement(programPosition);
+
+		if (nextPosition < 0)
+			programEnd = programPosition + 1;
+
+		programPosition = nextPosition;
+	}
+
+#if defined(LABEL_INDEX_DEBUG) && MAX_PROGRAM_LABELS > 0
+	Serial.print(F(".Labels indexed: "));
+	Serial.print(noOfIndexedLabels);
+	Serial.print(F(" complete: "));
+	Serial.println(labelIndexComplete);
+#endif
+}
+
+// Find a label in the program
+// Returns the offset into the program where the label is declared, or -1
+// The first parameter is the first character of the label, which ends 
+// with a statement terminator. 
+// The second parameter is the start of the program. The label index is 
+// used if it was built for that program, otherwise the label statements 
+// are compared in turn and the rest are stepped over using their lengths.
+
+//#define FIND_LABEL_IN_PROGRAM_DEBUG
+
+int findLabelInProgram(char * label, int programPosition)
+{
+#if MAX_PROGRAM_LABELS > 0
+	if (programPosition == labelIndexBase)
+	{
+		uint16_t hash = LABEL_HASH_START;
+
+		for (char * ch = label; *ch != STATEMENT_TERMINATOR; ch++)
+			hash = hashLabelChar(hash, *ch);
+
+		for (byte i = 0; i < noOfIndexedLabels; i++)
+		{
+			if (labelIndex[i].hash == hash && labelMatches(label, labelIndex[i].position))
+			{
+#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
+				Serial.print("Label index match at: ");
+				Serial.println(labelIndex[i].position);
+#endif
+				return labelIndex[i].position;
 			}
 		}
+
+		if (labelIndexComplete)
+			return -1;
+
+		// carry on from the first label that is not in the index
+		if (noOfIndexedLabels > 0)
+			programPosition = findNextStatement(labelIndex[noOfIndexedLabels - 1].position);
+	}
+#endif
+
+	while (programPosition >= 0)
+	{
+		if (readProgramByte(programPosition) == OPCODE_LABEL && labelMatches(label, programPosition))
+		{
+#ifdef FIND_LABEL_IN_PROGRAM_DEBUG
+			Serial.print("Label match at: ");
+			Serial.println(programPosition);
+#endif
+			return programPosition;
+		}
+
+		programPosition = findNextStatement(programPosition);
+	}
+
+	return -1;
+}
+
+// Returns the program position of the label at decodePos, or -1 if the 
+// label is not in the program. A compiled jump holds the position of its 
+// label. A command from the host holds the name, which is looked up in 
+// the stored program.
+
+int readLabelTarget()
+{
+	if (decodingCompiledStatement && *decodePos == LABEL_TOKEN)
+	{
+		if (compiledLabelTarget == UNRESOLVED_LABEL)
+			return -1;
+
+		return (int)compiledLabelTarget;
 	}
+
+	if (!isProgramStored())
+		return -1;
+
+	return findLabelInProgram(decodePos, programBase);
 }
 
 // Command CJxxxx - jump to label
@@ -1498,10 +2200,7 @@ void jumpToLabel()
 	Serial.println(".**jump to label");
 #endif
 
-	char * labelPos = decodePos;
-	char * labelSearch = decodePos;
-
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = readLabelTarget();
 
 #ifdef JUMP_TO_LABEL_DEBUG
 	Serial.print("Label statement pos: ");
@@ -1519,14 +2218,14 @@ void jumpToLabel()
 #endif
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println("CJOK");
+			Serial.println(F("CJOK"));
 		}
 	}
 	else
 	{
 		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 		{
-			Serial.println("CJFAIL: no dest");
+			Serial.println(F("CJFAIL: no dest"));
 		}
 	}
 }
@@ -1544,10 +2243,7 @@ void jumpToLabelCoinToss()
 
 #endif
 
-	char * labelPos = decodePos;
-	char * labelSearch = decodePos;
-
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = readLabelTarget();
 
 #ifdef JUMP_TO_LABEL_COIN_DEBUG
 	Serial.print("  Label statement pos: ");
@@ -1558,7 +2254,7 @@ void jumpToLabelCoinToss()
 	{
 		// the label has been found - jump to it
 
-		if (random(0, 2) == 0)
+		if (randomRange(0, 2) == 0)
 		{
 			programCounter = labelStatementPos;
 			if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
@@ -1588,7 +2284,45 @@ void jumpToLabelCoinToss()
 	}
 }
 
+// Command CSddd - seed the random number generator
+// Programs that start with the same seed will make the same coin tosses
+// and random light patterns each time they run. 
+// Return CSOK
+
+void remoteSeedRandom()
+{
+	if (readArguments(1, NULL) == 0)
+	{
+		commandFailed(F("CSFail: no seed"));
+		return;
+	}
+
+	seedRandom((uint16_t)commandArguments.values[0]);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CSOK"));
+	}
+}
+
+// Command CBddd - set the program time budget in microseconds
+// Return CBOK
 
+void setProgramTimeBudget()
+{
+	if (readArguments(1, NULL) == 0 || commandArguments.values[0] < 0)
+	{
+		commandFailed(F("CBFail: invalid budget"));
+		return;
+	}
+
+	programTimeBudget = commandArguments.values[0];
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("CBOK"));
+	}
+}
 
 // Command CA - pause when motors active
 // Return CAOK when the pause is started
@@ -1618,7 +2352,9 @@ void measureDistanceAndJump()
 	Serial.println(F(".**measure disance and jump to label"));
 #endif
 
-	int distance = readInteger();
+	readArguments(1, NULL);
+
+	int distance = commandArguments.values[0];
 
 #ifdef COMMAND_MEASURE_DEBUG
 	Serial.print(F(".  Distance: "));
@@ -1650,7 +2386,7 @@ void measureDistanceAndJump()
 		return;
 	}
 
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = readLabelTarget();
 
 #ifdef COMMAND_MEASURE_DEBUG
 	Serial.print("Label statement pos: ");
@@ -1723,7 +2459,7 @@ void jumpWhenMotorsInactive()
 		return;
 	}
 
-	int labelStatementPos = findLabelInProgram(decodePos, programBase);
+	int labelStatementPos = readLabelTarget();
 
 #ifdef JUMP_MOTORS_INACTIVE_DEBUG
 	Serial.print("Label statement pos: ");
@@ -1765,363 +2501,867 @@ void jumpWhenMotorsInactive()
 	// otherwise do nothing
 }
 
-void programControl()
+
+//#define REMOTE_DOWNLOAD_DEBUG
+
+// RM - start remote download
+
+void remoteDownload()
 {
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+
+#ifdef REMOTE_DOWNLOAD_DEBUG
+	Serial.println(F(".**remote download"));
+#endif
+
+	if (deviceState != ACCEPTING_COMMANDS)
 	{
-		Serial.println(F("FAIL: missing program control command character"));
+		Serial.println(F("RMFAIL: not accepting commands"));
 		return;
 	}
 
-#ifdef COMMAND_DEBUG
-	Serial.println(F(".**remoteProgramControl: "));
+	startDownloadingCode(STORED_PROGRAM_OFFSET);
+}
+
+void startProgramCommand()
+{
+	startProgramExecution(STORED_PROGRAM_OFFSET);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("RSOK"));
+	}
+}
+
+
+void haltProgramExecutionCommand()
+{
+	haltProgramExecution();
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("RHOK"));
+	}
+}
+
+
+// Kept in flash, as a String would hold a copy in SRAM
+#define VERSION_TEXT "Version 3.1"
+
+// IV - information display version
+
+void displayVersion()
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IVOK"));
+	}
+
+	Serial.println(F(VERSION_TEXT));
+}
+
+void displayDistance()
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IDOK"));
+	}
+	Serial.println(getDistanceValueInt());
+}
+
+void printStatus()
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("ISOK"));
+	}
+	Serial.print(programState);
+	Serial.println(diagnosticsOutputLevel);
+
+}
+
+
+// IMddd - set the debugging diagnostics level
+
+//#define SET_MESSAGING_DEBUG 
+
+void setMessaging()
+{
+
+#ifdef SET_MESSAGING_DEBUG
+		Serial.println(F(".**informationlevelset: "));
 #endif
 
-	char commandCh = *decodePos;
+	readArguments(1, NULL);
 
-#ifdef COMMAND_DEBUG
-	Serial.print(F(".   Program command : "));
-	Serial.println(commandCh);
+	byte no = commandArguments.values[0];
+
+#ifdef SET_MESSAGING_DEBUG
+	Serial.print(F(".  Setting: "));
+	Serial.println(no);
 #endif
 
-	decodePos++;
+	diagnosticsOutputLevel = no;
 
-	switch (commandCh)
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
 	{
-	case 'I':
-	case 'i':
-		jumpWhenMotorsInactive();
-		break;
-	case 'A':
-	case 'a': 
-		pauseWhenMotorsActive();
-		break;
-	case 'D':
-	case 'd':
-		remoteDelay();
-		break;
-	case 'L':
-	case 'l':
-		declareLabel();
+		Serial.println(F("IMOK"));
+	}
+}
+
+void printProgram()
+{
+	dumpProgramFromEEPROM(STORED_PROGRAM_OFFSET);
+
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IPOK"));
+	}
+}
+
+// IF - send the pixels on the strip as a frame dump line
+
+void displayFrame()
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("IFOK"));
+	}
+	dumpFrame();
+}
+
+// IT - send the time taken by each stage of drawing the lights and 
+// start a new set of timings
+
+void displayLightTimings()
+{
+	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	{
+		Serial.println(F("ITOK"));
+	}
+	printStageTimings();
+	resetStageTimings();
+}
+
+// The readings are printed a piece at a time rather than formatted into a 
+// buffer, so that the line does not need room on the stack
+
+void sendSensorReadings()
+{
+	// version 1
+	Serial.print(F("{\"version\":1,\"distance\":["));
+	Serial.print(getDistanceValueInt());
+	Serial.print(F("],\"lightLevel\":["));
+	Serial.print(analogRead(0));
+	Serial.print(',');
+	Serial.print(analogRead(1));
+	Serial.print(',');
+	Serial.print(analogRead(2));
+	Serial.println(F("]}\r"));
+}
+
+
+/////////////////////////////////////////////
+//
+//  Command table
+//
+/////////////////////////////////////////////
+
+// Every command starts with a group letter and a command letter. The 
+// handlers are listed in a table in flash, sorted by the two letters, 
+// in the same order as the command numbers. The letters are matched 
+// in upper case. 
+// The flags say what must be done before a pixel command runs, and how 
+// a command is compiled into a stored program.
+// The position of a command in the table is its opcode in stored programs. 
+// If commands are added or removed PROGRAM_STORED_VALUE2 must be changed, 
+// so that programs stored by older versions are not run.
+
+// the command stops a timed busy pixel display
+#define COMMAND_CANCELS_BUSY_PIXEL 1
+// the command sets the lights, so it takes over from the light mode
+#define COMMAND_SETS_LIGHTS 2
+// the command declares a label
+#define COMMAND_DECLARES_LABEL 4
+// the command ends with the name of a label to jump to
+#define COMMAND_JUMPS 8
+// the label of the jump follows a number and a comma
+#define COMMAND_LABEL_AFTER_NUMBER 16
+
+#define PIXEL_COMMAND COMMAND_CANCELS_BUSY_PIXEL
+#define LIGHT_COMMAND (COMMAND_CANCELS_BUSY_PIXEL | COMMAND_SETS_LIGHTS)
+
+// Command numbers, in the order of the command table
+
+enum commandNumbers
+{
+	commandCA,
+	commandCB,
+	commandCD,
+	commandCI,
+	commandCJ,
+	commandCL,
+	commandCM,
+	commandCS,
+	commandCT,
+	commandID,
+	commandIF,
+	commandIM,
+	commandIP,
+	commandIR,
+	commandIS,
+	commandIT,
+	commandIV,
+	commandMA,
+	commandMC,
+	commandMF,
+	commandMM,
+	commandMR,
+	commandMS,
+	commandMV,
+	commandMW,
+	commandPA,
+	commandPB,
+	commandPC,
+	commandPD,
+	commandPE,
+	commandPF,
+	commandPG,
+	commandPH,
+	commandPI,
+	commandPL,
+	commandPM,
+	commandPN,
+	commandPO,
+	commandPP,
+	commandPR,
+	commandPS,
+	commandPW,
+	commandPX,
+	commandRH,
+	commandRM,
+	commandRP,
+	commandRR,
+	commandRS,
+	NO_OF_COMMAND_NUMBERS
+};
+
+typedef void(*commandHandler)();
+
+struct CommandEntry
+{
+	char group;
+	char command;
+	byte flags;
+	commandHandler handler;
+};
+
+const struct CommandEntry commandTable[] PROGMEM = {
+	{ 'C', 'A', 0, pauseWhenMotorsActive },
+	{ 'C', 'B', 0, setProgramTimeBudget },
+	{ 'C', 'D', 0, remoteDelay },
+	{ 'C', 'I', COMMAND_JUMPS, jumpWhenMotorsInactive },
+	{ 'C', 'J', COMMAND_JUMPS, jumpToLabel },
+	{ 'C', 'L', COMMAND_DECLARES_LABEL, declareLabel },
+	{ 'C', 'M', COMMAND_JUMPS | COMMAND_LABEL_AFTER_NUMBER, measureDistanceAndJump },
+	{ 'C', 'S', 0, remoteSeedRandom },
+	{ 'C', 'T', COMMAND_JUMPS, jumpToLabelCoinToss },
+	{ 'I', 'D', 0, displayDistance },
+	{ 'I', 'F', 0, displayFrame },
+	{ 'I', 'M', 0, setMessaging },
+	{ 'I', 'P', 0, printProgram },
+	{ 'I', 'R', 0, sendSensorReadings },
+	{ 'I', 'S', 0, printStatus },
+	{ 'I', 'T', 0, displayLightTimings },
+	{ 'I', 'V', 0, displayVersion },
+	{ 'M', 'A', 0, remoteMoveAngle },
+	{ 'M', 'C', 0, checkMoving },
+	{ 'M', 'F', 0, remoteMoveForwards },
+	{ 'M', 'M', 0, remoteMoveMotors },
+	{ 'M', 'R', 0, remoteRotateRobot },
+	{ 'M', 'S', 0, remoteStopRobot },
+	{ 'M', 'V', 0, remoteViewWheelConfig },
+	{ 'M', 'W', 0, remoteConfigWheels },
+	{ 'P', 'A', PIXEL_COMMAND, remoteSetBlendMode },
+	{ 'P', 'B', LIGHT_COMMAND, remoteFrameUpload },
+	{ 'P', 'C', LIGHT_COMMAND, remoteColouredCandle },
+	{ 'P', 'D', LIGHT_COMMAND, remoteDeltaFrameUpload },
+	{ 'P', 'E', PIXEL_COMMAND, remoteSplitSegments },
+	{ 'P', 'F', LIGHT_COMMAND, remoteSetFlickerSpeed },
+	{ 'P', 'G', PIXEL_COMMAND, remoteGammaCorrection },
+	{ 'P', 'H', LIGHT_COMMAND, remoteHueColour },
+	{ 'P', 'I', LIGHT_COMMAND, remoteSetIndividualPixel },
+	{ 'P', 'L', PIXEL_COMMAND, remoteLightMode },
+	{ 'P', 'M', LIGHT_COMMAND, remoteMoveLights },
+	{ 'P', 'N', LIGHT_COMMAND, remoteNamedColour },
+	{ 'P', 'O', LIGHT_COMMAND, remoteSetPixelsOff },
+	{ 'P', 'P', PIXEL_COMMAND, remotePowerBudget },
+	{ 'P', 'R', LIGHT_COMMAND, remoteSetRandomColors },
+	{ 'P', 'S', PIXEL_COMMAND, remoteSelectSegment },
+	{ 'P', 'W', LIGHT_COMMAND, remoteRainbow },
+	{ 'P', 'X', LIGHT_COMMAND, remoteFadeToColor },
+	{ 'R', 'H', 0, haltProgramExecutionCommand },
+	{ 'R', 'M', 0, remoteDownload },
+	{ 'R', 'P', 0, pauseProgramExecution },
+	{ 'R', 'R', 0, resumeProgramExecution },
+	{ 'R', 'S', 0, startProgramCommand }
+};
+
+#define NO_OF_COMMANDS (sizeof(commandTable) / sizeof(struct CommandEntry))
+
+inline char upperCase(char ch)
+{
+	if (ch >= 'a' && ch <= 'z')
+		return ch - 'a' + 'A';
+	return ch;
+}
+
+// Returns the position of the command in the table, or -1 if there is 
+// no such command
+// Every command from the host is looked up, so the letters are decoded 
+// with switches, which the compiler turns into jump tables, rather than 
+// searched for in the table. A command added to the table must be added 
+// here too. The host CommandTableTest checks that every entry is found.
+
+int findCommand(char group, char command)
+{
+	command = upperCase(command);
+
+	switch (upperCase(group))
+	{
+	case 'C':
+		switch (command)
+		{
+		case 'A':
+			return commandCA;
+		case 'B':
+			return commandCB;
+		case 'D':
+			return commandCD;
+		case 'I':
+			return commandCI;
+		case 'J':
+			return commandCJ;
+		case 'L':
+			return commandCL;
+		case 'M':
+			return commandCM;
+		case 'S':
+			return commandCS;
+		case 'T':
+			return commandCT;
+		}
 		break;
-	case 'J':
-	case 'j':
-		jumpToLabel();
+	case 'I':
+		switch (command)
+		{
+		case 'D':
+			return commandID;
+		case 'F':
+			return commandIF;
+		case 'M':
+			return commandIM;
+		case 'P':
+			return commandIP;
+		case 'R':
+			return commandIR;
+		case 'S':
+			return commandIS;
+		case 'T':
+			return commandIT;
+		case 'V':
+			return commandIV;
+		}
 		break;
 	case 'M':
-	case 'm':
-		measureDistanceAndJump();
+		switch (command)
+		{
+		case 'A':
+			return commandMA;
+		case 'C':
+			return commandMC;
+		case 'F':
+			return commandMF;
+		case 'M':
+			return commandMM;
+		case 'R':
+			return commandMR;
+		case 'S':
+			return commandMS;
+		case 'V':
+			return commandMV;
+		case 'W':
+			return commandMW;
+		}
+		break;
+	case 'P':
+		switch (command)
+		{
+		case 'A':
+			return commandPA;
+		case 'B':
+			return commandPB;
+		case 'C':
+			return commandPC;
+		case 'D':
+			return commandPD;
+		case 'E':
+			return commandPE;
+		case 'F':
+			return commandPF;
+		case 'G':
+			return commandPG;
+		case 'H':
+			return commandPH;
+		case 'I':
+			return commandPI;
+		case 'L':
+			return commandPL;
+		case 'M':
+			return commandPM;
+		case 'N':
+			return commandPN;
+		case 'O':
+			return commandPO;
+		case 'P':
+			return commandPP;
+		case 'R':
+			return commandPR;
+		case 'S':
+			return commandPS;
+		case 'W':
+			return commandPW;
+		case 'X':
+			return commandPX;
+		}
 		break;
-	case 'T':
-	case 't':
-		jumpToLabelCoinToss();
+	case 'R':
+		switch (command)
+		{
+		case 'H':
+			return commandRH;
+		case 'M':
+			return commandRM;
+		case 'P':
+			return commandRP;
+		case 'R':
+			return commandRR;
+		case 'S':
+			return commandRS;
+		}
 		break;
 	}
+
+	return -1;
 }
 
-//#define REMOTE_DOWNLOAD_DEBUG
+// Runs the command at the given position in the table with the arguments 
+// at decodePos
 
-// RM - start remote download
+void runCommand(byte commandNo)
+{
+	byte flags = pgm_read_byte(&commandTable[commandNo].flags);
 
-void remoteDownload()
+	if (flags & COMMAND_CANCELS_BUSY_PIXEL)
+		cancelBusyPixelWait();
+
+	if (flags & COMMAND_SETS_LIGHTS)
+		stopLightMode();
+
+	commandHandler handler = (commandHandler)pgm_read_word(&commandTable[commandNo].handler);
+	handler();
+}
+
+void processCommand(char * commandDecodePos, char * comandDecodeLimit)
 {
+	decodePos = commandDecodePos;
+	decodeLimit = comandDecodeLimit;
+
+	*decodeLimit = 0;
+
+#ifdef COMMAND_DEBUG
+	Serial.print(F(".**processCommand:"));
+	Serial.println((char *)decodePos);
 
-#ifdef REMOTE_DOWNLOAD_DEBUG
-	Serial.println(F(".**remote download"));
 #endif
 
-	if (deviceState != ACCEPTING_COMMANDS)
+	char groupCh = *decodePos;
+
+	// Ignore comments
+	if (groupCh == '#')
+		return;
+
+	char commandCh = 0;
+
+	if (decodePos + 1 != decodeLimit)
 	{
-		Serial.println(F("RMFAIL: not accepting commands"));
+		decodePos++;
+		commandCh = *decodePos;
+		decodePos++;
+	}
+
+#ifdef COMMAND_DEBUG
+	Serial.print(F(".  Command code : "));
+	Serial.print(groupCh);
+	Serial.println(commandCh);
+#endif
+
+	int commandNo = findCommand(groupCh, commandCh);
+
+	if (commandNo < 0)
+	{
+#ifdef COMMAND_DEBUG
+		Serial.println(F(".  Invalid command : "));
+#endif
+		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+		{
+			Serial.print(F("Invalid Command: "));
+			Serial.print(groupCh);
+			Serial.print(commandCh);
+			Serial.print(F(" code: "));
+			Serial.println((int)groupCh);
+		}
 		return;
 	}
 
-	startDownloadingCode(STORED_PROGRAM_OFFSET);
+	runCommand(commandNo);
+}
+
+/////////////////////////////////////////////
+//
+//  Stored program compiler
+//
+/////////////////////////////////////////////
+
+//#define COMPILE_DEBUG
+
+byte commandFlags(byte opcode)
+{
+	return pgm_read_byte(&commandTable[opcode - 1].flags);
+}
+
+// Returns the end of the integer at pos, or NULL if there is not one there. 
+// Accepts the same forms as readInteger.
+
+char * integerEnd(char * pos, char * end)
+{
+	if (pos != end && *pos == '-')
+		pos++;
+
+	if (pos != end && *pos == '+')
+		pos++;
+
+	if (pos == end || *pos < '0' || *pos > '9')
+		return NULL;
+
+	while (pos != end && *pos >= '0' && *pos <= '9')
+		pos++;
+
+	return pos;
+}
+
+int compileWritePosition;
+byte compiledLength;
+
+// A compiled statement always fits in the command buffer when it runs, 
+// because each value and label name is shorter there than in the text, 
+// so only the room in the EEPROM is checked. Room is left for the 
+// program terminator.
+
+bool writeCompiledByte(byte b)
+{
+	if (compileWritePosition >= EEPROM_SIZE - 1)
+		return false;
+
+	writeProgramByte(compileWritePosition++, b);
+	compiledLength++;
+	return true;
 }
 
-void startProgramCommand()
+bool writeCompiledValue(byte token, uint16_t value)
 {
-	startProgramExecution(STORED_PROGRAM_OFFSET);
-
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-	{
-		Serial.println(F("RSOK"));
-	}
+	return writeCompiledByte(token) &&
+		writeCompiledByte((byte)value) &&
+		writeCompiledByte((byte)(value >> 8));
 }
 
+// Compiles a statement into the program at programWriteBase. The text 
+// ends with a statement terminator, which is included in the length. 
+// Returns false, and stores nothing, if the statement is not a command, 
+// is a jump without a label or does not fit in the program. The failure 
+// is reported with the line number of the download. A blank line is left 
+// out of the program without a report.
 
-void haltProgramExecutionCommand()
+bool compileStatement(char * text, byte length)
 {
-	haltProgramExecution();
+	if (length <= 1)
+		return true;
 
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-	{
-		Serial.println(F("RHOK"));
-	}
-}
+	char * pos = text;
+	char * end = text + length - 1;
+	byte opcode;
+	byte flags = 0;
 
-void remoteManagement()
-{
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
+	if (*pos == '#')
 	{
-		Serial.println(F("FAIL: missing remote control command character"));
-		return;
+		opcode = OPCODE_COMMENT;
+		pos++;
 	}
+	else
+	{
+		int commandNo = -1;
 
-#ifdef COMMAND_DEBUG
-	Serial.println(F(".**remoteProgramDownload: "));
-#endif
+		if (length > 2)
+			commandNo = findCommand(text[0], text[1]);
 
-	char commandCh = *decodePos;
+		if (commandNo < 0)
+		{
+			downloadFailed(F("invalid command"));
+			return false;
+		}
 
-#ifdef COMMAND_DEBUG
-	Serial.print(F(".   Download command : "));
-	Serial.println(commandCh);
-#endif
+		opcode = commandNo + 1;
+		flags = commandFlags(opcode);
 
-	decodePos++;
+		if (flags & COMMAND_DECLARES_LABEL)
+			opcode = OPCODE_LABEL;
 
-	switch (commandCh)
-	{
-	case 'M':
-	case 'm':
-		remoteDownload();
-		break;
-	case 'S':
-	case 's':
-		startProgramCommand();
-		break;
-	case 'H':
-	case 'h':
-		haltProgramExecutionCommand();
-		break;
-	case 'P':
-	case 'p':
-		pauseProgramExecution();
-		break;
-	case 'R':
-	case 'r':
-		resumeProgramExecution();
-		break;
+		pos += 2;
 	}
-}
 
-const String version = "Version 3.1";
-
-// IV - information display version
+#ifdef COMPILE_DEBUG
+	Serial.print(F(".Compiling opcode: "));
+	Serial.println(opcode);
+#endif
 
-void displayVersion()
-{
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-	{
-		Serial.println(F("IVOK"));
-	}
+	// write the operands after the opcode and length, which are written 
+	// last so that a statement that does not fit leaves nothing behind
+	compileWritePosition = programWriteBase + 2;
+	compiledLength = 0;
 
-	Serial.println(version);
-}
+	bool compileNumbers = opcode != OPCODE_COMMENT && opcode != OPCODE_LABEL;
+	bool itemStart = true;
+	bool fits = true;
+	bool labelStored = false;
+	byte values = 0;
 
-void displayDistance()
-{
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	if (flags & COMMAND_LABEL_AFTER_NUMBER)
 	{
-		Serial.println(F("IDOK"));
-	}
-	Serial.println(getDistanceValueInt());
-}
+		char * numberEnd = integerEnd(pos, end);
 
-void printStatus()
-{
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-	{
-		Serial.println(F("ISOK"));
+		if (numberEnd == NULL || numberEnd == end || *numberEnd != ',')
+		{
+			downloadFailed(F("number and label expected"));
+			return false;
+		}
 	}
-	Serial.print(programState);
-	Serial.println(diagnosticsOutputLevel);
 
-}
+	decodeLimit = end;
 
+	while (pos != end && fits)
+	{
+		char * numberEnd = NULL;
 
-// IMddd - set the debugging diagnostics level
+		if (compileNumbers && itemStart)
+			numberEnd = integerEnd(pos, end);
 
-//#define SET_MESSAGING_DEBUG 
+		// the label of a jump is all of the text, or all of it after 
+		// the number
+		if ((flags & COMMAND_JUMPS) && itemStart && (values > 0 || !(flags & COMMAND_LABEL_AFTER_NUMBER)))
+		{
+			fits = writeCompiledValue(LABEL_TOKEN, UNRESOLVED_LABEL);
 
-void setMessaging()
-{
+			while (pos != end && fits)
+				fits = writeCompiledByte(*pos++);
 
-#ifdef SET_MESSAGING_DEBUG
-		Serial.println(F(".**informationlevelset: "));
-#endif
+			labelStored = true;
+			break;
+		}
 
-	byte no = readInteger();
+		if (numberEnd != NULL)
+		{
+			// the values are put in the command arguments when the 
+			// statement runs
+			if (++values > MAX_COMMAND_ARGUMENTS)
+			{
+				downloadFailed(F("too many numbers"));
+				return false;
+			}
 
-#ifdef SET_MESSAGING_DEBUG
-	Serial.print(F(".  Setting: "));
-	Serial.println(no);
-#endif
+			decodePos = pos;
+			fits = writeCompiledValue(INTEGER_TOKEN, (uint16_t)readInteger());
+			pos = numberEnd;
+			itemStart = false;
+			continue;
+		}
 
-	diagnosticsOutputLevel = no;
+		itemStart = *pos == ',';
+		fits = writeCompiledByte(*pos++);
+	}
 
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	if (!fits)
 	{
-		Serial.println(F("IMOK"));
+		downloadFailed(F("program full"));
+		return false;
 	}
-}
-
-void printProgram()
-{
-	dumpProgramFromEEPROM(STORED_PROGRAM_OFFSET);
 
-	if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+	if ((flags & COMMAND_JUMPS) && !labelStored)
 	{
-		Serial.println(F("IPOK"));
+		downloadFailed(F("missing label"));
+		return false;
 	}
-}
 
-void sendSensorReadings()
-{
-	char buffer[100];
+	writeProgramByte(programWriteBase, opcode);
+	writeProgramByte(programWriteBase + 1, compiledLength);
 
-	sprintf(buffer, "{\"version\":%d,\"distance\":[%d],\"lightLevel\":[%d,%d,%d]}\r",
-		1, // version 1
-		getDistanceValueInt(), analogRead(0), analogRead(1), analogRead(2));
+	programWriteBase = compileWritePosition;
 
-	Serial.println(buffer);
+	return true;
 }
 
-void information()
+// Points each compiled jump at its label. Called at the end of a download, 
+// when all the labels have been stored. Jumps to labels that are not in 
+// the program are reported and left unresolved, so they fail when they run.
+// Returns the number of jumps to missing labels.
+
+byte resolveProgramLabels()
 {
-	if (*decodePos == STATEMENT_TERMINATOR | decodePos == decodeLimit)
-	{
-		Serial.println(F("FAIL: missing information command character"));
-		return;
-	}
+	int statement = STORED_PROGRAM_OFFSET;
+	byte missingLabels = 0;
 
-#ifdef COMMAND_DEBUG
-	Serial.println(F(".**remoteProgramDownload: "));
-#endif
+	buildLabelIndex(STORED_PROGRAM_OFFSET);
 
-	char commandCh = *decodePos;
+	while (statement >= 0)
+	{
+		byte opcode = readProgramByte(statement);
 
-#ifdef COMMAND_DEBUG
-	Serial.print(F(".   Download command : "));
-	Serial.println(commandCh);
-#endif
+		if (opcode != PROGRAM_TERMINATOR && opcode != OPCODE_LABEL && opcode != OPCODE_COMMENT &&
+			(commandFlags(opcode) & COMMAND_JUMPS))
+		{
+			int pos = statement + 2;
+			int end = pos + readProgramByte(statement + 1);
 
-	decodePos++;
+			// skip any numbers before the label
+			while (pos < end && readProgramByte(pos) != LABEL_TOKEN)
+			{
+				if (readProgramByte(pos) == INTEGER_TOKEN)
+					pos += 3;
+				else
+					pos++;
+			}
 
-	switch (commandCh)
-	{
-	case 'V':
-	case 'v':
-		displayVersion();
-		break;
-	case 'D':
-	case 'd':
-		displayDistance();
-		break;
-	case 'S':
-	case 's':
-		printStatus();
-		break;
-	case 'M':
-	case 'm':
-		setMessaging();
-		break;
-	case 'P':
-	case 'p':
-		printProgram();
-		break;
-	case 'R':
-	case 'r':
-		sendSensorReadings();
-		break;
-	}
-}
+			if (pos < end)
+			{
+				// copy the name into the command buffer to search for it
+				byte nameLength = 0;
 
-void processCommand(char * commandDecodePos, char * comandDecodeLimit)
-{
-	decodePos = commandDecodePos;
-	decodeLimit = comandDecodeLimit;
+				for (int i = pos + 3; i < end; i++)
+					programCommand[nameLength++] = readProgramByte(i);
 
-	*decodeLimit = 0;
+				programCommand[nameLength] = STATEMENT_TERMINATOR;
 
-#ifdef COMMAND_DEBUG
-	Serial.print(F(".**processCommand:"));
-	Serial.println((char *)decodePos);
+				int target = findLabelInProgram(programCommand, STORED_PROGRAM_OFFSET);
 
-#endif
+				uint16_t value = target < 0 ? UNRESOLVED_LABEL : (uint16_t)target;
 
-	char commandCh = *decodePos;
+				writeProgramByte(pos + 1, (byte)value);
+				writeProgramByte(pos + 2, (byte)(value >> 8));
 
-#ifdef COMMAND_DEBUG
-	Serial.print(F(".  Command code : "));
-	Serial.println(commandCh);
-#endif
+				if (target < 0)
+				{
+					missingLabels++;
 
-	decodePos++;
+					if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
+					{
+						Serial.print(F("Missing label: "));
+						for (byte i = 0; i < nameLength; i++)
+							Serial.print(programCommand[i]);
+						Serial.print(F(" at: "));
+						Serial.println(statement);
+					}
+				}
 
-	switch (commandCh)
-	{
-	case '#':
-		// Ignore comments
-		break;
-	case 'I':
-	case 'i':
-		information();
-		break;
-	case 'M':
-	case 'm':
-		remoteMoveControl();
-		break;
-	case 'P':
-	case 'p':
-		remotePixelControl();
-		break;
-	case 'C':
-	case 'c':
-		programControl();
-		break;
-	case 'R':
-	case 'r':
-		remoteManagement();
-		break;
-	default:
-#ifdef COMMAND_DEBUG
-		Serial.println(F(".  Invalid command : "));
+#ifdef COMPILE_DEBUG
+				Serial.print(F(".Jump at: "));
+				Serial.print(statement);
+				Serial.print(F(" to: "));
+				Serial.println(target);
 #endif
-		if (diagnosticsOutputLevel & STATEMENT_CONFIRMATION)
-		{
-			Serial.print(F("Invalid Command: "));
-			Serial.print(commandCh);
-			Serial.print(F(" code: "));
-			Serial.println((int)commandCh);
+			}
 		}
+
+		statement = findNextStatement(statement);
 	}
+
+	return missingLabels;
 }
 
-void interpretCommandByte(byte b)
+// Lists the program stored in the EEPROM, turning the bytecode back into 
+// the commands that were downloaded
+
+void dumpProgramFromEEPROM(int EEPromStart)
 {
-	if (commandPos == bufferLimit)
+	Serial.println(F("Current program: "));
+
+	int pos = EEPromStart;
+
+	while (true)
 	{
-#ifdef COMMAND_DEBUG
-		Serial.println(F(".  Command buffer full - resetting"));
-#endif
-		resetCommand();
-		return;
-	}
+		if (pos + 1 >= EEPROM_SIZE)
+		{
+			Serial.println(F("Reached end of eeprom"));
+			break;
+		}
 
-	*commandPos = b;
+		byte opcode = EEPROM.read(pos);
+
+		if (opcode == PROGRAM_TERMINATOR)
+		{
+			Serial.println(F("Reached end of program"));
+			break;
+		}
 
-	commandPos++;
+		int end = pos + 2 + EEPROM.read(pos + 1);
+		pos += 2;
 
-	if (b == STATEMENT_TERMINATOR)
-	{
-#ifdef COMMAND_DEBUG
-		Serial.println(F(".  Command end"));
-#endif
-		processCommand(programCommand, commandPos);
-		resetCommand();
-		return;
+		switch (opcode)
+		{
+		case OPCODE_COMMENT:
+			Serial.print('#');
+			break;
+		case OPCODE_LABEL:
+			Serial.print(F("CL"));
+			break;
+		default:
+			Serial.print((char)pgm_read_byte(&commandTable[opcode - 1].group));
+			Serial.print((char)pgm_read_byte(&commandTable[opcode - 1].command));
+			break;
+		}
+
+		while (pos < end && pos < EEPROM_SIZE)
+		{
+			byte b = EEPROM.read(pos);
+
+			if (b == INTEGER_TOKEN)
+			{
+				Serial.print((int)(int16_t)(EEPROM.read(pos + 1) | (EEPROM.read(pos + 2) << 8)));
+				pos += 3;
+			}
+			else
+			{
+				// the label name follows the target
+				if (b == LABEL_TOKEN)
+				{
+					pos += 3;
+				}
+				else
+				{
+					Serial.print((char)b);
+					pos++;
+				}
+			}
+		}
+
+		Serial.println();
 	}
 }
 
@@ -2168,6 +3408,9 @@ void processSerialByte(byte b)
 	case DOWNLOADING_CODE:
 		storeReceivedByte(b);
 		break;
+	case RECEIVING_FRAME:
+		receiveFrameByte(b);
+		break;
 	}
 }
 
@@ -2182,12 +3425,12 @@ void setupRemoteControl()
 }
 
 // Executes the statement in the EEPROM at the current program counter
-// The statement is assembled into a buffer by interpretCommandByte
+// The integers go into the command arguments and the rest of the operands 
+// into the command buffer, and the command is called straight from its 
+// opcode
 
 bool exeuteProgramStatement()
 {
-	char programByte;
-
 #ifdef PROGRAM_DEBUG
 	Serial.println(F(".Executing statement"));
 #endif
@@ -2198,27 +3441,84 @@ bool exeuteProgramStatement()
 		Serial.println((int)programCounter);
 	}
 
-	while (true)
+	if (programCounter + 1 >= EEPROM_SIZE)
 	{
-		programByte = EEPROM.read(programCounter++);
+		haltProgramExecution();
+		return false;
+	}
 
-		if (programCounter >= EEPROM_SIZE || programByte == PROGRAM_TERMINATOR)
-		{
-			haltProgramExecution();
-			return false;
-		}
+	byte opcode = readProgramByte(programCounter);
+
+	if (opcode == PROGRAM_TERMINATOR)
+	{
+		haltProgramExecution();
+		return false;
+	}
+
+	byte length = readProgramByte(programCounter + 1);
+	int operands = programCounter + 2;
+
+	// move on before the command runs, so that a jump can replace it
+	programCounter = operands + length;
 
 #ifdef PROGRAM_DEBUG
-		Serial.print(F(".    program byte: "));
-		Serial.println(programByte);
+	Serial.print(F(".    opcode: "));
+	Serial.println(opcode);
 #endif
 
-		interpretCommandByte(programByte);
+	if (opcode == OPCODE_COMMENT)
+		return true;
+
+	if (opcode == OPCODE_LABEL)
+	{
+		declareLabel();
+		return true;
+	}
+
+	char * copyPos = programCommand;
+	byte values = 0;
+
+	while (operands < programCounter)
+	{
+		byte b = readProgramByte(operands);
+
+		if (b == INTEGER_TOKEN)
+		{
+			// the compiler allows no more values than there is room for, 
+			// so this only drops values from a damaged program
+			if (values < MAX_COMMAND_ARGUMENTS)
+			{
+				commandArguments.values[values++] = (int16_t)(readProgramByte(operands + 1) | (readProgramByte(operands + 2) << 8));
+				*copyPos++ = b;
+			}
+			operands += 3;
+			continue;
+		}
+
+		*copyPos++ = b;
 
-		if (programByte == STATEMENT_TERMINATOR)
-			return true;
+		if (b == LABEL_TOKEN)
+		{
+			// the name of the label is not needed to make the jump
+			compiledLabelTarget = readProgramByte(operands + 1) | (readProgramByte(operands + 2) << 8);
+			break;
+		}
 
+		operands++;
 	}
+
+	*copyPos = STATEMENT_TERMINATOR;
+
+	decodePos = programCommand;
+	decodeLimit = copyPos + 1;
+	*decodeLimit = 0;
+
+	compiledValuesRead = 0;
+	decodingCompiledStatement = true;
+	runCommand(opcode - 1);
+	decodingCompiledStatement = false;
+
+	return true;
 }
 
 //const char SAMPLE_CODE[] PROGMEM = { "PC255,0,0\rCD5\rCLtop\rPC0,0,255\rCD5\rPC0,255,255\rCD5\rPC255,0,255\rCD5\rCJtop\r" };
@@ -2226,20 +3526,30 @@ const char SAMPLE_CODE[] PROGMEM = { "CLtop\rCM10,close\rPC255,0,0\rCJtop\rCLclo
 
 void loadTestProgram(int offset)
 {
-	int inPos = 0;
-	int outPos = offset;
-
 	int len = strlen_P(SAMPLE_CODE);
 	int i;
 	char myChar;
 
+	programWriteBase = offset;
+	downloadLineNumber = 0;
+	resetCommand();
+
 	for (i = 0; i < len; i++)
 	{
 		myChar = pgm_read_byte_near(SAMPLE_CODE + i);
-		EEPROM.write(outPos++, myChar);
+		*commandPos++ = myChar;
+
+		if (myChar == STATEMENT_TERMINATOR)
+		{
+			downloadLineNumber++;
+			compileStatement(programCommand, commandPos - programCommand);
+			resetCommand();
+		}
 	}
 
-	EEPROM.write(outPos, 0);
+	writeProgramByte(programWriteBase, PROGRAM_TERMINATOR);
+
+	resolveProgramLabels();
 
 	dumpProgramFromEEPROM(offset);
 }
@@ -2255,14 +3565,27 @@ void updateProgramExcecution()
 		processSerialByte(b);
 	}
 
+	checkFrameReceiveTimeout();
+
 	switch (programState)
 	{
 	case PROGRAM_STOPPED:
 	case PROGRAM_PAUSED:
 		break;
 	case PROGRAM_ACTIVE:
-		exeuteProgramStatement();
+	{
+		unsigned long sliceStart = micros();
+
+		// stops when a statement waits, pauses or ends the program, or 
+		// starts a transfer from the host
+		while (exeuteProgramStatement() && programState == PROGRAM_ACTIVE &&
+			deviceState == ACCEPTING_COMMANDS)
+		{
+			if (micros() - sliceStart >= (unsigned long)programTimeBudget)
+				break;
+		}
 		break;
+	}
 	case PROGRAM_AWAITING_MOVE_COMPLETION:
 		if (!motorsMoving())
 			programState = PROGRAM_ACTIVE;
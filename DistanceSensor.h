@@ -23,6 +23,10 @@ volatile int distanceSensorReadingIntervalInMillisecs;
 
 volatile unsigned long timeOfLastDistanceReading;
 
+// Counts the readings as they arrive, so that code which uses the distance 
+// can tell when there is a new one. Only the changes matter, so it can wrap.
+volatile byte distanceReadingCount = 0;
+
 void pulseEvent()
 {
 	if (PIND & (1 << echoPin)) {
@@ -32,6 +36,7 @@ void pulseEvent()
 	else
 	{
 		pulseWidth = micros() - pulseStartTime;
+		distanceReadingCount++;
 		distanceSensorState = DISTANCE_SENSOR_READING_READY;
 	}
 }
@@ -0,0 +1,366 @@
+///////////////////////////////////////////////////////////
+/// Light modes
+///////////////////////////////////////////////////////////
+
+// A light mode drives the lights from the state of the robot, so the host
+// does not have to send pixel commands to go with everything it does.
+// The mode is checked every TICK_INTERVAL and the lights are only changed
+// when what they are showing needs to change.
+// The mode runs in the segment that was active when it was set. Any pixel 
+// command that sets the lights in that segment puts the mode back to manual.
+// A frame uploaded by the host covers the whole strip, so it puts the mode 
+// back to manual whichever segment it runs in. The lights are not kept 
+// apart from the frame.
+
+enum lightModes
+{
+	lightModeManual,    // lights are set by pixel commands
+	lightModeMotion,    // lights show what the motors are doing
+	lightModeProximity  // lights show how close the nearest obstacle is
+};
+
+byte lightMode = lightModeManual;
+
+// segment the mode draws in
+byte lightModeSegment = 0;
+
+unsigned long lastLightModeUpdate;
+
+//#define LIGHT_MODE_DEBUG
+
+/////////////////////////////////////////////
+//
+//  Motion mode
+//
+/////////////////////////////////////////////
+
+// Two marker lights run round the ring at a speed that follows the faster
+// wheel. Green is forwards, orange is backwards and blue is turning on the
+// spot. When the motors stop the ring shows brake red.
+
+enum motionDisplays
+{
+	motionNotShown,
+	motionStopped,
+	motionForward,
+	motionReverse,
+	motionSpin
+};
+
+// Number of motor steps for the markers to go once round the segment
+#define MOTION_STEPS_PER_RING_TURN 1024
+
+#define MOTION_TICKS_PER_SECOND (1000 / TICK_INTERVAL)
+
+byte motionShown = motionNotShown;
+int8_t motionShownDist;
+byte motionShownSpeed;
+
+unsigned long wheelStepsPerSecond(char delta, unsigned long intervalBetweenSteps)
+{
+	if (delta == 0 || intervalBetweenSteps == 0)
+		return 0;
+	return 1000000UL / intervalBetweenSteps;
+}
+
+void showMotionColour(byte display)
+{
+	lightColor colour;
+
+	switch (display)
+	{
+	case motionForward:
+		colour = green;
+		break;
+	case motionReverse:
+		colour = orange;
+		break;
+	case motionSpin:
+		colour = blue;
+		break;
+	default:
+		colour = red;
+		break;
+	}
+
+	byte r, g, b;
+	selectColour(colour, &r, &g, &b);
+
+	if (display == motionStopped)
+	{
+		// brake lights use the whole ring
+		steadyColouredLights(r, g, b);
+		return;
+	}
+
+	byte first = segmentFirstLight();
+	byte noOfLights = segmentLightLimit() - first;
+
+	setAllLightsOff();
+
+	if (noOfLights == 0)
+		return;
+
+	setLightColor(r, g, b, first);
+	setLightColor(r, g, b, first + noOfLights / 2);
+}
+
+void updateMotionMode()
+{
+	char leftDelta = leftMotorWaveformDelta;
+	char rightDelta = rightMotorWaveformDelta;
+
+	byte display;
+	int8_t direction = 1;
+
+	if (leftDelta == 0 && rightDelta == 0)
+	{
+		display = motionStopped;
+	}
+	else
+	{
+		if (leftDelta >= 0 && rightDelta >= 0)
+		{
+			display = motionForward;
+		}
+		else
+		{
+			if (leftDelta <= 0 && rightDelta <= 0)
+			{
+				display = motionReverse;
+				direction = -1;
+			}
+			else
+			{
+				display = motionSpin;
+				if (leftDelta < 0)
+					direction = -1;
+			}
+		}
+	}
+
+	int8_t dist = 0;
+	byte speed = 0;
+
+	if (display != motionStopped)
+	{
+		unsigned long leftRate = wheelStepsPerSecond(leftDelta, leftIntervalBetweenSteps);
+		unsigned long rightRate = wheelStepsPerSecond(rightDelta, rightIntervalBetweenSteps);
+		unsigned long stepsPerSecond = leftRate > rightRate ? leftRate : rightRate;
+
+		struct Segment * seg = &segments[activeSegment];
+		unsigned long segmentPositions = (seg->pixelLimit - seg->firstPixel) * NO_OF_GAPS;
+
+		unsigned long positionsPerSecond = (stepsPerSecond * segmentPositions) / MOTION_STEPS_PER_RING_TURN;
+
+		if (positionsPerSecond >= MOTION_TICKS_PER_SECOND)
+		{
+			// move at least one position every tick
+			unsigned long positionsPerTick = positionsPerSecond / MOTION_TICKS_PER_SECOND;
+			dist = positionsPerTick > 127 ? 127 : (int8_t)positionsPerTick;
+			speed = 1;
+		}
+		else
+		{
+			if (positionsPerSecond > 0)
+			{
+				// move one position every few ticks
+				dist = 1;
+				speed = MOTION_TICKS_PER_SECOND / positionsPerSecond;
+			}
+		}
+
+		dist = dist * direction;
+	}
+
+	if (display == motionShown && dist == motionShownDist && speed == motionShownSpeed)
+		return;
+
+#ifdef LIGHT_MODE_DEBUG
+	Serial.print(F(".Motion display: "));
+	Serial.print(display);
+	Serial.print(F(" dist: "));
+	Serial.print(dist);
+	Serial.print(F(" speed: "));
+	Serial.println(speed);
+#endif
+
+	if (display != motionShown)
+	{
+		showMotionColour(display);
+		motionShown = display;
+	}
+
+	moveLights(moveWrap, dist, speed, 0, 0);
+
+	motionShownDist = dist;
+	motionShownSpeed = speed;
+}
+
+/////////////////////////////////////////////
+//
+//  Proximity mode
+//
+/////////////////////////////////////////////
+
+// Each new distance reading sets the lights along the ring. More lights 
+// are lit as an obstacle gets closer, and the colour runs from green at 
+// the far distance to red at the near distance. One light is always lit 
+// to show that the mode is running. 
+
+#define PROXIMITY_DEFAULT_NEAR 10
+#define PROXIMITY_DEFAULT_FAR 100
+
+// hue at the far distance, the hue falls to red as obstacles get closer
+#define PROXIMITY_FAR_HUE 512
+
+int proximityNear = PROXIMITY_DEFAULT_NEAR;
+int proximityFar = PROXIMITY_DEFAULT_FAR;
+
+byte proximityReadingCount;
+byte proximityShownLights;
+uint16_t proximityShownHue;
+
+void setProximityRange(int nearDistance, int farDistance)
+{
+	if (nearDistance < 0)
+		nearDistance = 0;
+
+	if (farDistance <= nearDistance)
+		farDistance = nearDistance + 1;
+
+	proximityNear = nearDistance;
+	proximityFar = farDistance;
+}
+
+void updateProximityMode()
+{
+	if (distanceReadingCount == proximityReadingCount)
+		return;
+
+	proximityReadingCount = distanceReadingCount;
+
+	int distance = getDistanceValueInt();
+
+	// no echo has been timed yet
+	if (distance == 0)
+		return;
+
+	// closeness from 0 at the far distance to 256 at the near distance
+	uint16_t closeness;
+
+	if (distance <= proximityNear)
+	{
+		closeness = 256;
+	}
+	else
+	{
+		if (distance >= proximityFar)
+			closeness = 0;
+		else
+			closeness = (uint16_t)(((long)(proximityFar - distance) * 256) / (proximityFar - proximityNear));
+	}
+
+	byte first = segmentFirstLight();
+	byte noOfLights = segmentLightLimit() - first;
+
+	if (noOfLights == 0)
+		return;
+
+	byte litLights = 1 + (byte)((closeness * (noOfLights - 1)) >> 8);
+	uint16_t hue = PROXIMITY_FAR_HUE - (uint16_t)(((uint32_t)closeness * PROXIMITY_FAR_HUE) >> 8);
+
+	if (litLights == proximityShownLights && hue == proximityShownHue)
+		return;
+
+#ifdef LIGHT_MODE_DEBUG
+	Serial.print(F(".Proximity distance: "));
+	Serial.print(distance);
+	Serial.print(F(" lights: "));
+	Serial.print(litLights);
+	Serial.print(F(" hue: "));
+	Serial.println(hue);
+#endif
+
+	byte r, g, b;
+	hsvToRgb(hue, 255, 255, &r, &g, &b);
+
+	for (byte i = 0; i < noOfLights; i++)
+	{
+		if (i < litLights)
+			setLightColor(r, g, b, first + i);
+		else
+			lights[first + i].lightState = lightStateOff;
+	}
+
+	proximityShownLights = litLights;
+	proximityShownHue = hue;
+}
+
+/////////////////////////////////////////////
+//
+//  Mode control
+//
+/////////////////////////////////////////////
+
+// Returns false if the mode is not known
+
+bool setLightMode(byte mode)
+{
+	if (mode > lightModeProximity)
+		return false;
+
+	lightMode = mode;
+	lightModeSegment = activeSegment;
+
+	// make the new mode draw straight away
+	motionShown = motionNotShown;
+	proximityShownLights = 0;
+	proximityReadingCount = distanceReadingCount - 1;
+	lastLightModeUpdate = millis() - TICK_INTERVAL;
+
+	return true;
+}
+
+// Called before a pixel command changes the lights in the active segment
+
+void stopLightMode()
+{
+	if (activeSegment == lightModeSegment)
+		lightMode = lightModeManual;
+}
+
+// Called when the host starts to send a frame
+
+void stopAllLightModes()
+{
+	lightMode = lightModeManual;
+}
+
+void updateLightModes()
+{
+	if (lightMode == lightModeManual)
+		return;
+
+	unsigned long now = millis();
+
+	if (now - lastLightModeUpdate < TICK_INTERVAL)
+		return;
+
+	lastLightModeUpdate = now;
+
+	byte savedSegment = activeSegment;
+	activeSegment = lightModeSegment;
+
+	switch (lightMode)
+	{
+	case lightModeMotion:
+		updateMotionMode();
+		break;
+	case lightModeProximity:
+		updateProximityMode();
+		break;
+	}
+
+	activeSegment = savedSegment;
+}
@@ -1,16 +1,39 @@
 #include <Adafruit_NeoPixel.h>
 
+// The strip geometry is fixed at compile time. Define PIXELS and NO_OF_LIGHTS 
+// before this file is included to drive a different strip. 
+// Lights are not tied to pixels - each light has a position on the strip and
+// the lights start out evenly spread along it. Each light costs SRAM, so a long 
+// strip will usually have fewer lights than pixels. 
+
+#ifndef PIXELS
 #define PIXELS 12
+#endif
+
 #define VERSION 1
 
+#ifndef NO_OF_LIGHTS
 #define NO_OF_LIGHTS 12
+#endif
+
+#if PIXELS > 255 || NO_OF_LIGHTS > 255
+#error "The light engine supports at most 255 pixels and 255 lights"
+#endif
 
 #define TICK_INTERVAL 20
 
-unsigned long tickEnd;
+// When nothing is animating the lights are only redrawn when they change, 
+// plus a refresh at this interval. Set to 0 to turn the refresh off.
+#define IDLE_REFRESH_INTERVAL 500
 
+unsigned long lastTickTime;
+
+// Number of positions between each pixel
 #define NO_OF_GAPS 32
 
+// Number of positions along the whole strip
+#define LIGHT_POSITIONS (PIXELS*NO_OF_GAPS)
+
 #define NEOPIN 12
 
 Adafruit_NeoPixel strip = Adafruit_NeoPixel(PIXELS, NEOPIN, NEO_GRB + NEO_KHZ800);
@@ -19,18 +42,87 @@ Adafruit_NeoPixel strip = Adafruit_NeoPixel(PIXELS, NEOPIN, NEO_GRB + NEO_KHZ800
 
 //#define DISPLAY_LIGHT_SETTINGS
 
+// Sends every frame to the serial port as it is shown
+//#define DUMP_FRAMES
+
 byte lightBrightness = 100;
 
+// Positions are held in NO_OF_GAPS steps per pixel, so a light can sit 
+// between two pixels and is drawn across both of them. 
+// A moving light moves moveDist steps every moveSpeed ticks, between 
+// posMin and posMax. If posMax is not above posMin the light moves 
+// along the whole strip. 
+
+enum moveModes
+{
+	moveWrap,    // leave one end of the range and come back at the other
+	moveBounce   // reverse direction at the ends of the range
+};
+
 typedef enum lightStates
 {
 	lightStateOff,
 	lightStateColourBounce,
 	lightStateFlickerFixed,
 	lightStateFlickerRandom,
-	lightStateSteady
+	lightStateSteady,
+	lightStateHueCycle
+};
+
+// The lights are packed to save SRAM. The colour bounce limits are only 
+// used by the bounce and transition states and the hue settings only by 
+// the hue cycle state, so they share the same bytes. Flicker settings are 
+// usually the same for every light, so they are held in a small table of 
+// flicker blocks and each light holds the number of the block it uses. 
+
+struct FlickerBlock {
+	byte speed;
+	byte min;
+	byte max;
 };
 
+#define NO_OF_FLICKER_BLOCKS 4
+
+struct FlickerBlock flickerBlocks[NO_OF_FLICKER_BLOCKS];
+
 struct Light {
+	byte r, g, b;
+	byte colourSpeed;
+	byte flickerBrightness;
+	int8_t flickerUpdate;
+	byte lightState : 3;
+	byte moveMode : 1;
+	byte flickerBlock : 2;
+	byte transitioning : 1;
+	int pos, posMax, posMin;
+	int8_t moveDist;
+	byte moveSpeed;
+	union {
+		// used in the colour bounce and flicker states
+		// a light in a transition holds its start colour in the 
+		// minimums and its target colour in the maximums
+		struct {
+			byte rMax, rMin;
+			byte gMax, gMin;
+			byte bMax, bMin;
+			int8_t rUpdate, gUpdate, bUpdate;
+		};
+		// used in the hue cycle state
+		struct {
+			uint16_t hue;
+			int8_t hueUpdate;
+			byte saturation;
+			int8_t saturationUpdate;
+			byte value;
+			int8_t valueUpdate;
+		};
+	};
+} lights[NO_OF_LIGHTS];
+
+// Light settings sent by the host use the original unpacked layout. 
+// They are translated into the packed form when they arrive. 
+
+struct LightSettings {
 	byte r, rMax, rMin;
 	int8_t rUpdate;
 	byte g, gMax, gMin;
@@ -47,14 +139,420 @@ struct Light {
 	int8_t moveDist;
 	byte moveSpeed;
 	lightStates lightState;
-} lights[NO_OF_LIGHTS];
+};
+
+#define LIGHT_SETTINGS_SIZE sizeof(struct LightSettings)
+
+// Finds a flicker block with the given settings for a light. If there is 
+// no match a block that no other light is flickering with is reused. If 
+// every block is in use the closest match is used. 
+
+byte findFlickerBlock(byte lightNo, byte speed, byte min, byte max)
+{
+	byte block;
+
+	for (block = 0; block < NO_OF_FLICKER_BLOCKS; block++)
+	{
+		if (flickerBlocks[block].speed == speed &&
+			flickerBlocks[block].min == min &&
+			flickerBlocks[block].max == max)
+			return block;
+	}
+
+	for (block = 0; block < NO_OF_FLICKER_BLOCKS; block++)
+	{
+		byte i;
+		for (i = 0; i < NO_OF_LIGHTS; i++)
+		{
+			if (i != lightNo && lights[i].flickerBlock == block && lights[i].flickerUpdate != 0)
+				break;
+		}
+
+		if (i == NO_OF_LIGHTS)
+		{
+			flickerBlocks[block].speed = speed;
+			flickerBlocks[block].min = min;
+			flickerBlocks[block].max = max;
+			return block;
+		}
+	}
+
+	byte closest = 0;
+	int closestDistance = 0x7FFF;
+
+	for (block = 0; block < NO_OF_FLICKER_BLOCKS; block++)
+	{
+		int distance = abs(flickerBlocks[block].speed - speed) * 16 +
+			abs(flickerBlocks[block].min - min) + 
+			abs(flickerBlocks[block].max - max);
+
+		if (distance < closestDistance)
+		{
+			closest = block;
+			closestDistance = distance;
+		}
+	}
+
+	return closest;
+}
 
 int tickCount;
 
-bool randomColourTransitions = false;
+// Set by showFrame if any of the lights are animating
+bool lightsAnimating = false;
+
+// Set when the strip is showing a frame sent by the host 
+// The lights are not drawn until one of them is changed
+bool rawFrameMode = false;
+
+/////////////////////////////////////////////
+//
+//  Segments
+//
+/////////////////////////////////////////////
+
+// The strip can be split into segments, each with its own lights, effect 
+// and frame rate. The lights are shared out between the segments in 
+// proportion to the number of pixels in each one. The effect functions 
+// work on the lights in the active segment. 
+// Each segment has its own transition clock, so a fade started in one 
+// segment does not disturb a fade that is running in another. 
+// A segment is only updated and drawn when it has changed or its next 
+// frame is due, so a fast busy display on a few pixels does not redraw 
+// the rest of the strip. 
+// All the segments are on the one strip. Another strip on a second pin 
+// would need its own pixel buffer, which will not fit in the SRAM.
+
+#ifndef NO_OF_SEGMENTS
+#define NO_OF_SEGMENTS 3
+#endif
+
+struct Segment
+{
+	byte firstPixel;
+	byte pixelLimit;         // one past the last pixel
+	byte firstLight;
+	byte lightLimit;         // one past the last light
+	byte tickInterval;       // milliseconds between frames while animating
+	bool changed : 1;        // settings changed since the segment was drawn
+	bool animating : 1;      // the segment will change on a future tick
+	bool transitionRunning : 1;
+	bool randomTransitions : 1;  // start a new random fade when one ends
+	int tickCount;
+	uint16_t lastTickTime;   // low bits of millis, the intervals are short
+	byte transitionCurve;
+	uint16_t transitionLevel;  // progress after the curve, from 0 to 256
+	unsigned long transitionStartMillis;
+	unsigned long transitionMillis;
+} segments[NO_OF_SEGMENTS];
+
+byte noOfSegments = 1;
+
+// segment used by the effect functions
+byte activeSegment = 0;
+
+//#define SEGMENT_DEBUG
+
+// Splits the strip at the given pixel numbers. No edges gives a single 
+// segment covering the whole strip. Returns false if the edges are not 
+// in order or are off the strip, in which case the segments are unchanged.
+
+bool splitSegments(byte * edges, byte noOfEdges)
+{
+	if (noOfEdges >= NO_OF_SEGMENTS)
+		return false;
+
+	byte start = 0;
+
+	for (byte i = 0; i < noOfEdges; i++)
+	{
+		if (edges[i] <= start || edges[i] >= PIXELS)
+			return false;
+		start = edges[i];
+	}
+
+	noOfSegments = noOfEdges + 1;
+	activeSegment = 0;
+
+	start = 0;
+
+	for (byte s = 0; s < noOfSegments; s++)
+	{
+		struct Segment * seg = &segments[s];
+
+		byte limit = s < noOfEdges ? edges[s] : PIXELS;
+
+		seg->firstPixel = start;
+		seg->pixelLimit = limit;
+		seg->firstLight = (byte)(((uint16_t)start * NO_OF_LIGHTS) / PIXELS);
+		seg->lightLimit = (byte)(((uint16_t)limit * NO_OF_LIGHTS) / PIXELS);
+		seg->tickInterval = TICK_INTERVAL;
+		seg->changed = true;
+		seg->animating = false;
+		seg->tickCount = 0;
+		// lights left in a transition land on their targets
+		seg->transitionRunning = false;
+		seg->randomTransitions = false;
+		seg->transitionLevel = 256;
+
+#ifdef SEGMENT_DEBUG
+		Serial.print(F(".Segment "));
+		Serial.print(s);
+		Serial.print(F(" pixels: "));
+		Serial.print(seg->firstPixel);
+		Serial.print(F("-"));
+		Serial.print(seg->pixelLimit);
+		Serial.print(F(" lights: "));
+		Serial.print(seg->firstLight);
+		Serial.print(F("-"));
+		Serial.println(seg->lightLimit);
+#endif
+
+		start = limit;
+	}
+
+	return true;
+}
+
+void resetSegments()
+{
+	splitSegments(NULL, 0);
+}
+
+// Returns false if there is no such segment
+
+bool selectSegment(byte s)
+{
+	if (s >= noOfSegments)
+		return false;
+
+	activeSegment = s;
+	return true;
+}
+
+void setSegmentTickInterval(byte interval)
+{
+	if (interval == 0)
+		interval = TICK_INTERVAL;
+
+	segments[activeSegment].tickInterval = interval;
+}
+
+inline byte segmentFirstLight()
+{
+	return segments[activeSegment].firstLight;
+}
+
+inline byte segmentLightLimit()
+{
+	return segments[activeSegment].lightLimit;
+}
+
+byte segmentOfLight(byte lightNo)
+{
+	for (byte s = 0; s < noOfSegments; s++)
+	{
+		if (lightNo < segments[s].lightLimit)
+			return s;
+	}
+	return noOfSegments - 1;
+}
+
+// Position of a light when the lights in its segment are spread evenly 
+// along the segment
+
+int lightHomePosition(byte lightNo)
+{
+	struct Segment * seg = &segments[segmentOfLight(lightNo)];
+
+	byte lightsInSegment = seg->lightLimit - seg->firstLight;
+	if (lightsInSegment == 0)
+		return seg->firstPixel * NO_OF_GAPS;
+
+	return (seg->firstPixel * NO_OF_GAPS) +
+		(int)(((long)(lightNo - seg->firstLight) * (seg->pixelLimit - seg->firstPixel) * NO_OF_GAPS) / lightsInSegment);
+}
+
+// Called whenever the light settings are changed so that the next frame 
+// is drawn straight away, even if the scene is otherwise static
+
+void setLightsChanged()
+{
+	segments[activeSegment].changed = true;
+	rawFrameMode = false;
+}
+
+void setLightChanged(byte lightNo)
+{
+	segments[segmentOfLight(lightNo)].changed = true;
+	rawFrameMode = false;
+}
+
+void markAllSegmentsChanged()
+{
+	for (byte s = 0; s < noOfSegments; s++)
+		segments[s].changed = true;
+}
+
+// Used by settings that apply to the whole strip
+
+void setAllSegmentsChanged()
+{
+	markAllSegmentsChanged();
+	rawFrameMode = false;
+}
+
+/////////////////////////////////////////////
+//
+//  Frame timing
+//
+/////////////////////////////////////////////
+
+// The time taken by each stage of drawing a frame is recorded so that 
+// we can see where the time goes when the loop overruns its frame.
+// The figures are reported and reset by the IT command.
+// The first four stages are recorded for each segment drawn, so their 
+// figures are for a single segment. Each stage keeps its own count of 
+// samples for its mean. When any count fills up all of the timings stop, 
+// so that they cover the same frames, until they are reset. A count of 
+// 0xFFFF samples of at most 0xFFFF microseconds cannot overflow the total.
+
+enum lightStage
+{
+	lightStageColours,
+	lightStagePosition,
+	lightStageFlicker,
+	lightStageRender,
+	lightStageShow,
+	NO_OF_LIGHT_STAGES
+};
+
+// The timings take 53 bytes of SRAM, so they are only built in when 
+// LIGHT_STAGE_TIMING is defined as 1. Otherwise IT says they are missing.
+
+#ifndef LIGHT_STAGE_TIMING
+#define LIGHT_STAGE_TIMING 0
+#endif
+
+#if LIGHT_STAGE_TIMING
+
+struct StageTiming
+{
+	unsigned int samples;
+	unsigned int minMicros;
+	unsigned int maxMicros;
+	unsigned long totalMicros;
+} stageTimings[NO_OF_LIGHT_STAGES];
+
+unsigned int timedFrames = 0;
+bool stageTimingsFull = false;
+
+void resetStageTimings()
+{
+	for (byte i = 0; i < NO_OF_LIGHT_STAGES; i++)
+	{
+		stageTimings[i].samples = 0;
+		stageTimings[i].minMicros = 0xFFFF;
+		stageTimings[i].maxMicros = 0;
+		stageTimings[i].totalMicros = 0;
+	}
+	timedFrames = 0;
+	stageTimingsFull = false;
+}
+
+// Records the time since stageStart against the stage
+// Returns the current time, which is the start of the next stage
+
+unsigned long recordStageTime(byte stage, unsigned long stageStart)
+{
+	unsigned long now = micros();
+
+	if (stageTimingsFull)
+		return now;
+
+	if (stageTimings[stage].samples == 0xFFFF)
+	{
+		stageTimingsFull = true;
+		return now;
+	}
+
+	unsigned long elapsed = now - stageStart;
+	unsigned int time = elapsed > 0xFFFF ? 0xFFFF : (unsigned int)elapsed;
+
+	stageTimings[stage].samples++;
+
+	if (time < stageTimings[stage].minMicros)
+		stageTimings[stage].minMicros = time;
+	if (time > stageTimings[stage].maxMicros)
+		stageTimings[stage].maxMicros = time;
+	stageTimings[stage].totalMicros += time;
+
+	return now;
+}
+
+void printStageTiming(const __FlashStringHelper * name, byte stage)
+{
+	Serial.print(name);
+
+	if (stageTimings[stage].samples == 0)
+	{
+		Serial.println(F(" none"));
+		return;
+	}
+
+	Serial.print(F(" samples:"));
+	Serial.print(stageTimings[stage].samples);
+	Serial.print(F(" min:"));
+	Serial.print(stageTimings[stage].minMicros);
+	Serial.print(F(" mean:"));
+	Serial.print(stageTimings[stage].totalMicros / stageTimings[stage].samples);
+	Serial.print(F(" max:"));
+	Serial.println(stageTimings[stage].maxMicros);
+}
+
+// Prints the stage timings in microseconds
+
+void printStageTimings()
+{
+	Serial.print(F("Frames: "));
+	Serial.println(timedFrames);
+
+	if (stageTimingsFull)
+		Serial.println(F("Stopped when full"));
+
+	if (timedFrames == 0)
+		return;
+
+	printStageTiming(F("Colours"), lightStageColours);
+	printStageTiming(F("Position"), lightStagePosition);
+	printStageTiming(F("Flicker"), lightStageFlicker);
+	printStageTiming(F("Render"), lightStageRender);
+	printStageTiming(F("Show"), lightStageShow);
+}
+
+#else
+
+inline unsigned long recordStageTime(byte stage, unsigned long stageStart)
+{
+	return stageStart;
+}
+
+void resetStageTimings()
+{
+}
+
+void printStageTimings()
+{
+	Serial.println(F("Stage timing not built in"));
+}
+
+#endif
 
 byte oldr = 0, oldg = 0, oldb = 0;
 
+// segment the old flicker values were set in
+byte oldFlickerSegment = 0;
+
 void resetOldFlickerValues()
 {
 	oldr = 0;
@@ -65,9 +563,9 @@ void resetOldFlickerValues()
 void setLightColor(byte r, byte g, byte b)
 {
 	byte i;
-	for (i = 0; i < NO_OF_LIGHTS; i++)
+	for (i = segmentFirstLight(); i < segmentLightLimit(); i++)
 	{
-		lights[i].pos = (int)((float)i / NO_OF_LIGHTS * (PIXELS*NO_OF_GAPS));
+		lights[i].pos = lightHomePosition(i);
 		lights[i].r = r;
 		lights[i].rMax = r;
 		lights[i].rMin = r;
@@ -78,7 +576,9 @@ void setLightColor(byte r, byte g, byte b)
 		lights[i].bMax = b;
 		lights[i].bMin = b;
 		lights[i].lightState = lightStateSteady;
+		lights[i].transitioning = 0;
 	}
+	setLightsChanged();
 }
 
 void setAllLilac()
@@ -88,37 +588,42 @@ void setAllLilac()
 
 void randomiseLight(byte lightNo)
 {
-	lights[lightNo].pos = (int)((float)lightNo / NO_OF_LIGHTS * (PIXELS*NO_OF_GAPS));
+	lights[lightNo].pos = lightHomePosition(lightNo);
+
+	lights[lightNo].r = (byte)randomRange(0, 256);
+	lights[lightNo].rMax = (byte)randomRange(lights[lightNo].r, 256);
+	lights[lightNo].rMin = (byte)randomRange(0, lights[lightNo].r);
 
-	lights[lightNo].r = (byte)random(0, 256);
-	lights[lightNo].rMax = (byte)random(lights[lightNo].r, 256);
-	lights[lightNo].rMin = (byte)random(0, lights[lightNo].r);
+	lights[lightNo].g = (byte)randomRange(0, 256);
+	lights[lightNo].gMax = (byte)randomRange(lights[lightNo].g, 256);
+	lights[lightNo].gMin = (byte)randomRange(0, lights[lightNo].g);
 
-	lights[lightNo].g = (byte)random(0, 256);
-	lights[lightNo].gMax = (byte)random(lights[lightNo].g, 256);
-	lights[lightNo].gMin = (byte)random(0, lights[lightNo].g);
+	lights[lightNo].b = (byte)randomRange(0, 256);
+	lights[lightNo].bMax = (byte)randomRange(lights[lightNo].b, 256);
+	lights[lightNo].bMin = (byte)randomRange(0, lights[lightNo].b);
 
-	lights[lightNo].b = (byte)random(0, 256);
-	lights[lightNo].bMax = (byte)random(lights[lightNo].b, 256);
-	lights[lightNo].bMin = (byte)random(0, lights[lightNo].b);
+	lights[lightNo].rUpdate = (int8_t)randomRange(-3, 4);
+	lights[lightNo].gUpdate = (int8_t)randomRange(-3, 4);
+	lights[lightNo].bUpdate = (int8_t)randomRange(-3, 4);
 
-	lights[lightNo].rUpdate = (int8_t)random(-3, 4);
-	lights[lightNo].gUpdate = (int8_t)random(-3, 4);
-	lights[lightNo].bUpdate = (int8_t)random(-3, 4);
+	lights[lightNo].colourSpeed = (byte)randomRange(100, 256);
 
-	lights[lightNo].colourSpeed = (byte)random(100, 256);
+	lights[lightNo].moveDist = (int8_t)randomRange(-3, 4);
+	lights[lightNo].moveSpeed = (byte)randomRange(1, 100);
 
-	lights[lightNo].moveDist = (int8_t)random(-3, 4);
-	lights[lightNo].moveSpeed = (byte)random(1, 100);
-	lights[lightNo].posMax = (int)random(0, PIXELS*NO_OF_GAPS);
-	lights[lightNo].posMin = (int)random(0, lights[lightNo].posMax);
+	struct Segment * seg = &segments[segmentOfLight(lightNo)];
+	lights[lightNo].posMax = (int)randomRange(seg->firstPixel * NO_OF_GAPS, seg->pixelLimit * NO_OF_GAPS);
+	lights[lightNo].posMin = (int)randomRange(seg->firstPixel * NO_OF_GAPS, lights[lightNo].posMax);
+	lights[lightNo].moveMode = moveWrap;
 	lights[lightNo].lightState = lightStateColourBounce;
+	lights[lightNo].transitioning = 0;
+	setLightChanged(lightNo);
 }
 
 void randomiseLights()
 {
 	byte i;
-	for (i = 0; i < NO_OF_LIGHTS; i++)
+	for (i = segmentFirstLight(); i < segmentLightLimit(); i++)
 	{
 		randomiseLight(i);
 	}
@@ -128,12 +633,14 @@ void randomiseLights()
 
 void setAllLightsOff()
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
 	{
 		lights[i].lightState = lightStateOff;
+		lights[i].transitioning = 0;
 	}
 	// force an update if we go into candle mode later
 	resetOldFlickerValues();
+	setLightsChanged();
 }
 
 void startLights()
@@ -142,6 +649,9 @@ void startLights()
 	Serial.println(".Starting lights");
 #endif  
 
+	resetStageTimings();
+	resetSegments();
+
 	strip.begin();
 	strip.show(); // Initialize all pixels to 'off'
 	setAllLightsOff();
@@ -156,14 +666,36 @@ void do_lightsOff()
 	setAllLightsOff();
 }
 
-void copyBlock(byte * dest, byte * src, int length)
+// Copies light settings sent by the host into a packed light
+
+void setLightFromSettings(byte lightNo, struct LightSettings * settings)
 {
-	for (int i = 0; i < length; i++)
-	{
-		*dest = *src;
-		dest++;
-		src++;
-	}
+	struct Light * l = &lights[lightNo];
+
+	(*l).r = (*settings).r;
+	(*l).rMax = (*settings).rMax;
+	(*l).rMin = (*settings).rMin;
+	(*l).rUpdate = (*settings).rUpdate;
+	(*l).g = (*settings).g;
+	(*l).gMax = (*settings).gMax;
+	(*l).gMin = (*settings).gMin;
+	(*l).gUpdate = (*settings).gUpdate;
+	(*l).b = (*settings).b;
+	(*l).bMax = (*settings).bMax;
+	(*l).bMin = (*settings).bMin;
+	(*l).bUpdate = (*settings).bUpdate;
+	(*l).colourSpeed = (*settings).colourSpeed;
+	(*l).flickerBrightness = (*settings).flickerBrightness;
+	(*l).flickerUpdate = (*settings).flickerUpdate;
+	(*l).flickerBlock = findFlickerBlock(lightNo, (*settings).flickerSpeed, 
+		(*settings).flickerMin, (*settings).flickerMax);
+	(*l).pos = (*settings).pos;
+	(*l).posMax = (*settings).posMax;
+	(*l).posMin = (*settings).posMin;
+	(*l).moveDist = (*settings).moveDist;
+	(*l).moveSpeed = (*settings).moveSpeed;
+	(*l).lightState = (*settings).lightState;
+	(*l).transitioning = 0;
 }
 
 void do_setLight(byte * command)
@@ -174,7 +706,8 @@ void do_setLight(byte * command)
 	Serial.print("Setting light ");
 	Serial.println(command[0]);
 #endif 
-	copyBlock((byte*)&lights[command[0]], (byte*)&command[1], sizeof(struct Light));
+	setLightFromSettings(command[0], (struct LightSettings *) &command[1]);
+	setLightChanged(command[0]);
 }
 
 void do_setAllLights(byte * command)
@@ -184,27 +717,376 @@ void do_setAllLights(byte * command)
 #ifdef SERIAL_VERBOSE
 	Serial.print("Setting all lights");
 #endif 
-	struct Light * src = (struct Light *) &command[0];
+	struct LightSettings * src = (struct LightSettings *) &command[0];
 	for (byte i = 0; i < NO_OF_LIGHTS; i++)
 	{
-		(*src).pos = i * NO_OF_GAPS;
-		copyBlock((byte*)&lights[i], (byte*)src, sizeof(struct Light));
+		setLightFromSettings(i, src);
+		lights[i].pos = lightHomePosition(i);
+	}
+	setAllSegmentsChanged();
+}
+
+/////////////////////////////////////////////
+//
+//  Frame buffer
+//
+/////////////////////////////////////////////
+
+// The lights are drawn into the frame buffer, which is copied to the strip 
+// once per frame. Lights that overlap are blended together rather than 
+// the last one drawn overwriting the others. 
+// The buffer costs PIXELS * 3 bytes of SRAM on top of the PIXELS * 3 that 
+// the NeoPixel library holds for the strip: 36 bytes for the 12 pixel ring, 
+// 180 for a 60 pixel strip. 
+
+byte frameBuffer[PIXELS][3];
+
+enum lightBlendModes
+{
+	blendAdd,  // add the colours, clamping at full brightness
+	blendMax   // keep the brighter of the colours
+};
+
+byte lightBlendMode = blendAdd;
+
+void setLightBlendMode(byte mode)
+{
+	if (mode > blendMax)
+		mode = blendAdd;
+	lightBlendMode = mode;
+	setAllSegmentsChanged();
+}
+
+// Sum of all the colour components in the frame buffer, kept up to date 
+// as the lights are blended in so that the power estimate needs no 
+// extra pass over the pixels. 
+unsigned long frameComponentTotal = 0;
+
+void clearFrameBuffer()
+{
+	byte * pos = &frameBuffer[0][0];
+	for (int i = 0; i < PIXELS * 3; i++)
+		*pos++ = 0;
+	frameComponentTotal = 0;
+}
+
+// Clears the pixels in one segment, so that it can be drawn again without 
+// touching the rest of the strip
+
+void clearSegmentPixels(struct Segment * seg)
+{
+	for (byte i = seg->firstPixel; i < seg->pixelLimit; i++)
+	{
+		byte * dest = frameBuffer[i];
+		frameComponentTotal -= dest[0] + dest[1] + dest[2];
+		dest[0] = 0;
+		dest[1] = 0;
+		dest[2] = 0;
+	}
+}
+
+inline byte blendComponent(byte current, byte added)
+{
+	if (lightBlendMode == blendMax)
+		return added > current ? added : current;
+
+	uint16_t total = current + added;
+	return total > 255 ? 255 : (byte)total;
+}
+
+inline void blendPixel(byte pixel, byte r, byte g, byte b)
+{
+	byte * dest = frameBuffer[pixel];
+	uint16_t before = dest[0] + dest[1] + dest[2];
+	dest[0] = blendComponent(dest[0], r);
+	dest[1] = blendComponent(dest[1], g);
+	dest[2] = blendComponent(dest[2], b);
+	frameComponentTotal += dest[0] + dest[1] + dest[2];
+	frameComponentTotal -= before;
+}
+
+/////////////////////////////////////////////
+//  Power budget
+//
+/////////////////////////////////////////////
+
+// Each colour in a pixel draws about 20mA at full brightness, so a 
+// component value of 255 is close to 5/64 of a milliamp per step. Each 
+// pixel also draws about 1mA when it is dark. 
+// If a frame would draw more than the power budget it is scaled down as 
+// it is sent to the strip. While the motors are running the budget is 
+// reduced by the motor allowance, so lights and motors together stay 
+// inside what the battery can supply. 
+// A budget of 0 turns the limit off. 
+
+#ifndef LIGHT_POWER_BUDGET
+#define LIGHT_POWER_BUDGET 0
+#endif
+
+#ifndef MOTOR_POWER_ALLOWANCE
+#define MOTOR_POWER_ALLOWANCE 300
+#endif
+
+#define PIXEL_IDLE_MILLIAMPS 1
+
+unsigned int lightPowerBudget = LIGHT_POWER_BUDGET;
+unsigned int motorPowerAllowance = MOTOR_POWER_ALLOWANCE;
+
+// estimate for the last frame before any scaling, in milliamps
+unsigned int frameMilliamps = 0;
+
+// scale applied to the last frame, 256 is full brightness
+uint16_t framePowerScale = 256;
+
+// whether the motors were running when the last frame was scaled
+bool powerMotorsMoving = false;
+
+bool motorsMoving();
+
+void setLightPowerBudget(unsigned int budget, unsigned int motorAllowance)
+{
+	lightPowerBudget = budget;
+	motorPowerAllowance = motorAllowance;
+	setAllSegmentsChanged();
+}
+
+// The frame buffer holds the lights before the global brightness is 
+// applied, so the estimate is scaled by it. Gamma correction makes the 
+// real current lower than this, so the estimate errs on the safe side.
+
+unsigned int estimateFrameMilliamps()
+{
+	unsigned long total = (frameComponentTotal * (lightBrightness + 1)) >> 8;
+	return (unsigned int)((total * 5) >> 6) + (PIXELS * PIXEL_IDLE_MILLIAMPS);
+}
+
+// Works out the scale for the frame in the buffer. One division per frame, 
+// the pixels themselves are scaled with a multiply and a shift. 
+
+uint16_t calculateFramePowerScale()
+{
+	frameMilliamps = estimateFrameMilliamps();
+
+	if (lightPowerBudget == 0)
+		return 256;
+
+	powerMotorsMoving = motorsMoving();
+
+	unsigned int budget = lightPowerBudget;
+
+	if (powerMotorsMoving)
+	{
+		// never go below a quarter of the budget, or the lights go dark
+		if (motorPowerAllowance < budget - (budget / 4))
+			budget = budget - motorPowerAllowance;
+		else
+			budget = budget / 4;
 	}
+
+	if (frameMilliamps <= budget)
+		return 256;
+
+	unsigned int idle = PIXELS * PIXEL_IDLE_MILLIAMPS;
+
+	if (budget <= idle)
+		return 0;
+
+	return (uint16_t)(((unsigned long)(budget - idle) << 8) / (frameMilliamps - idle));
 }
 
-void renderLight(int lightNo)
+// True if the motors have started or stopped since the last frame was 
+// scaled, so the frame needs to be sent again with the new budget. 
+
+bool powerBudgetChanged()
+{
+	if (lightPowerBudget == 0)
+		return false;
+	return motorsMoving() != powerMotorsMoving;
+}
+
+/////////////////////////////////////////////
+//  Gamma correction and dithering
+//
+/////////////////////////////////////////////
+
+// The eye is much more sensitive to changes in dim light than bright, so 
+// colours are passed through a gamma table on the way to the strip. The 
+// table gives 16 bit values, 8 bits of level and 8 bits of fraction. The 
+// global brightness is applied to these, which keeps the fine steps at 
+// the dim end instead of truncating them. 
+// The fractions are carried from frame to frame in the dither error, so 
+// a pixel at level 3.25 shows level 4 one frame in four and the eye sees 
+// the average. This only needs an add and a shift per colour per frame. 
+// Dithering is only used below DITHER_LEVEL_LIMIT, where the steps can be 
+// seen. Brighter levels are rounded, so a static bright scene does not 
+// need to be redrawn every tick. 
+// A dim scene that is not changing would otherwise be redrawn every tick 
+// for ever. The fractions are 8 bits, so every pixel has been through its 
+// whole pattern after DITHER_SETTLE_FRAMES frames, and then the frame is 
+// rounded and left alone until the lights change. 
+// The dither error costs PIXELS * 3 bytes of SRAM, 36 bytes for the 12 pixel 
+// ring and 180 for a 60 pixel strip, so it is only built in when 
+// LIGHT_DITHERING is defined as 1. Without it the levels are always rounded.
+
+#ifndef LIGHT_DITHERING
+#define LIGHT_DITHERING 0
+#endif
+
+const uint16_t gammaTable[256] PROGMEM = {
+	    0,     0,     2,     4,     7,    11,    17,    24,
+	   32,    42,    53,    65,    78,    94,   110,   128,
+	  148,   169,   191,   216,   241,   269,   298,   328,
+	  360,   394,   430,   467,   506,   547,   589,   633,
+	  679,   726,   776,   827,   880,   934,   991,  1049,
+	 1109,  1171,  1235,  1300,  1368,  1437,  1508,  1581,
+	 1656,  1733,  1812,  1893,  1975,  2060,  2146,  2235,
+	 2325,  2417,  2512,  2608,  2706,  2806,  2908,  3013,
+	 3119,  3227,  3337,  3450,  3564,  3680,  3798,  3919,
+	 4041,  4166,  4292,  4421,  4552,  4685,  4819,  4956,
+	 5096,  5237,  5380,  5525,  5673,  5823,  5974,  6128,
+	 6284,  6442,  6603,  6765,  6930,  7097,  7266,  7437,
+	 7610,  7786,  7963,  8143,  8325,  8509,  8696,  8885,
+	 9075,  9268,  9464,  9661,  9861, 10063, 10267, 10474,
+	10682, 10893, 11107, 11322, 11540, 11760, 11982, 12207,
+	12433, 12663, 12894, 13128, 13363, 13602, 13842, 14085,
+	14330, 14578, 14827, 15080, 15334, 15591, 15850, 16111,
+	16375, 16641, 16909, 17180, 17453, 17729, 18006, 18287,
+	18569, 18854, 19141, 19431, 19723, 20017, 20314, 20613,
+	20915, 21218, 21525, 21833, 22144, 22458, 22774, 23092,
+	23413, 23736, 24062, 24390, 24720, 25053, 25388, 25726,
+	26066, 26408, 26753, 27101, 27451, 27803, 28158, 28515,
+	28875, 29237, 29602, 29969, 30338, 30710, 31085, 31462,
+	31841, 32223, 32608, 32995, 33384, 33776, 34170, 34567,
+	34967, 35369, 35773, 36180, 36589, 37001, 37416, 37833,
+	38252, 38674, 39099, 39526, 39956, 40388, 40823, 41260,
+	41700, 42142, 42587, 43034, 43484, 43937, 44392, 44849,
+	45310, 45772, 46238, 46706, 47176, 47649, 48125, 48603,
+	49084, 49567, 50053, 50542, 51033, 51526, 52023, 52522,
+	53023, 53527, 54034, 54543, 55055, 55570, 56087, 56607,
+	57129, 57654, 58182, 58712, 59245, 59780, 60318, 60859,
+	61402, 61948, 62497, 63048, 63602, 64159, 64718, 65280
+};
+
+bool gammaCorrection = true;
+
+// set when the last frame had fractions to carry, so the frames must keep 
+// coming for the dithering to work even if nothing is moving
+bool frameDithering = false;
+
+void setGammaCorrection(bool on)
+{
+	gammaCorrection = on;
+	setAllSegmentsChanged();
+}
+
+// Returns the level of a colour component on the strip in 8.8 fixed point
+
+inline uint16_t gammaLevel(byte value, uint16_t scale)
+{
+	uint16_t level;
+
+	if (gammaCorrection)
+		level = pgm_read_word(&gammaTable[value]);
+	else
+		level = (uint16_t)value << 8;
+
+	return ((uint32_t)level * scale) >> 8;
+}
+
+inline byte roundedComponent(byte value, uint16_t scale)
+{
+	// level is at most 65280, so rounding cannot overflow
+	return (gammaLevel(value, scale) + 0x80) >> 8;
+}
+
+#if LIGHT_DITHERING
+
+#define DITHER_LEVEL_LIMIT 32
+
+#define DITHER_SETTLE_FRAMES 256
+
+// fractions left over from the last frame for each colour of each pixel
+byte ditherError[PIXELS][3];
+
+// frames shown since the lights last changed
+unsigned int ditherFramesSinceChange = 0;
+
+inline byte ditherComponent(byte value, uint16_t scale, byte * error)
+{
+	uint16_t level = gammaLevel(value, scale);
+
+	if (level == 0 || level >= (DITHER_LEVEL_LIMIT << 8))
+	{
+		*error = 0;
+		return (level + 0x80) >> 8;
+	}
+
+	level += *error;
+	*error = (byte)level;
+
+	if (*error != 0)
+		frameDithering = true;
+
+	return level >> 8;
+}
+
+#endif
+
+void flushFrameBuffer()
+{
+	framePowerScale = calculateFramePowerScale();
+
+	// brightness from 1 to 256 combined with the power budget scale
+	uint16_t scale = ((uint32_t)(lightBrightness + 1) * framePowerScale) >> 8;
+
+	frameDithering = false;
+
+#if LIGHT_DITHERING
+	if (ditherFramesSinceChange < DITHER_SETTLE_FRAMES)
+	{
+		for (byte i = 0; i < PIXELS; i++)
+		{
+			strip.setPixelColor(i,
+				ditherComponent(frameBuffer[i][0], scale, &ditherError[i][0]),
+				ditherComponent(frameBuffer[i][1], scale, &ditherError[i][1]),
+				ditherComponent(frameBuffer[i][2], scale, &ditherError[i][2]));
+		}
+		return;
+	}
+#endif
+
+	for (byte i = 0; i < PIXELS; i++)
+	{
+		strip.setPixelColor(i,
+			roundedComponent(frameBuffer[i][0], scale),
+			roundedComponent(frameBuffer[i][1], scale),
+			roundedComponent(frameBuffer[i][2], scale));
+	}
+}
+
+// Draws a light into the frame buffer. A light between two pixels is 
+// shared between them according to its position in the gap. Lights are 
+// kept inside their segment, and a light past the last pixel of the 
+// segment is shared with the first one.
+
+void renderLight(int lightNo, struct Segment * seg)
 {
 	if (lights[lightNo].lightState == lightStateOff) return;
 
 	int pos = lights[lightNo].pos;
-	byte firstLight = pos / NO_OF_GAPS;
-	byte secondLight = firstLight + 1;
-	if (secondLight == PIXELS) secondLight = 0;
+	if (pos < seg->firstPixel * NO_OF_GAPS || pos >= seg->pixelLimit * NO_OF_GAPS) return;
+
+	byte firstPixel = pos / NO_OF_GAPS;
+	byte secondPixel = firstPixel + 1;
+	if (secondPixel == seg->pixelLimit) secondPixel = seg->firstPixel;
 	byte positionInGap = pos % NO_OF_GAPS;
-	float secondFactor = (float)positionInGap / NO_OF_GAPS;
-	float firstFactor = 1 - secondFactor;
-	float flickerFactor = (float)lights[lightNo].flickerBrightness / 255;
-	float brightnessFactor = (float)lightBrightness / 255;
+
+	// brightness of the light from 0 to 256
+	// the global brightness is applied when the frame is flushed
+	uint16_t level = lights[lightNo].flickerBrightness + (lights[lightNo].flickerBrightness >> 7);
+
+	uint16_t firstLevel = (level * (NO_OF_GAPS - positionInGap)) / NO_OF_GAPS;
+	uint16_t secondLevel = level - firstLevel;
 
 #ifdef DISPLAY_LIGHT_SETTINGS
 	Serial.print("Rendering Light ");
@@ -215,44 +1097,93 @@ void renderLight(int lightNo)
 	Serial.print(lights[lightNo].g);
 	Serial.print(" ");
 	Serial.println(lights[lightNo].b);
-	Serial.print("firstLight:  ");
-	Serial.println(firstLight);
-	Serial.print("secondLight:  ");
-	Serial.println(secondLight);
+	Serial.print("firstPixel:  ");
+	Serial.println(firstPixel);
+	Serial.print("secondPixel:  ");
+	Serial.println(secondPixel);
 	Serial.print("Position:  ");
 	Serial.println(lights[lightNo].pos);
 	Serial.print("positionInGap:  ");
 	Serial.println(positionInGap);
-	Serial.print("secondFactor:  ");
-	Serial.println(secondFactor);
-	Serial.print("firstFactor:  ");
-	Serial.println(firstFactor);
-	Serial.print("flickerFactor:  ");
-	Serial.println(flickerFactor);
-	byte rv = lights[lightNo].r*firstFactor*flickerFactor*brightnessFactor;
-	Serial.print("First factor: ");
-	Serial.print(firstFactor);
-	Serial.print("Flicker factor: ");
-	Serial.print(flickerFactor);
-	Serial.print("Brightness factor: ");
-	Serial.print(brightnessFactor);
-	Serial.print("Brightness: ");
-	Serial.println(rv);
+	Serial.print("level:  ");
+	Serial.println(level);
+	Serial.print("firstLevel:  ");
+	Serial.println(firstLevel);
+	Serial.print("secondLevel:  ");
+	Serial.println(secondLevel);
 	//delay(2000);
 
 #endif 
 
-	strip.setPixelColor(firstLight,
-		(byte)(lights[lightNo].r*firstFactor*flickerFactor*brightnessFactor),
-		(byte)(lights[lightNo].g*firstFactor*flickerFactor*brightnessFactor),
-		(byte)(lights[lightNo].b*firstFactor*flickerFactor*brightnessFactor));
+	blendPixel(firstPixel,
+		(lights[lightNo].r * firstLevel) >> 8,
+		(lights[lightNo].g * firstLevel) >> 8,
+		(lights[lightNo].b * firstLevel) >> 8);
 
 	if (positionInGap != 0) {
-		strip.setPixelColor(secondLight,
-			(byte)(lights[lightNo].r*secondFactor*brightnessFactor),
-			(byte)(lights[lightNo].g*secondFactor*brightnessFactor),
-			(byte)(lights[lightNo].b*secondFactor*brightnessFactor));
+		blendPixel(secondPixel,
+			(lights[lightNo].r * secondLevel) >> 8,
+			(lights[lightNo].g * secondLevel) >> 8,
+			(lights[lightNo].b * secondLevel) >> 8);
+	}
+}
+
+inline char hexDigit(byte n)
+{
+	return n < 10 ? '0' + n : 'A' - 10 + n;
+}
+
+void printHexByte(byte b)
+{
+	Serial.print(hexDigit(b >> 4));
+	Serial.print(hexDigit(b & 0x0F));
+}
+
+// Sends the pixels on the strip to the serial port as a single line
+// The line starts with F and the tick count, followed by a colon and then
+// six hex digits (RRGGBB) for each pixel. 
+// A program on the host can capture these lines and turn them into images
+// so that a lighting change can be checked without watching the robot.
+
+void dumpFrame()
+{
+	Serial.print('F');
+	Serial.print(tickCount);
+	Serial.print(':');
+
+	for (uint16_t i = 0; i < strip.numPixels(); i++)
+	{
+		uint32_t colour = strip.getPixelColor(i);
+		printHexByte((byte)(colour >> 16));
+		printHexByte((byte)(colour >> 8));
+		printHexByte((byte)colour);
 	}
+
+	Serial.println();
+}
+
+// Called when the host starts to send a frame. The lights stop drawing so 
+// that the pixels can be written straight into the strip buffer. The frame 
+// stays on the strip until the lights are changed.
+
+void startRawFrame()
+{
+	rawFrameMode = true;
+	lightsAnimating = false;
+}
+
+void setRawPixel(byte pixel, byte r, byte g, byte b)
+{
+	strip.setPixelColor(pixel, r, g, b);
+}
+
+void showRawFrame()
+{
+	strip.show();
+
+#ifdef DUMP_FRAMES
+	dumpFrame();
+#endif
 }
 
 void steadyLight(int position, struct Light * l)
@@ -263,9 +1194,11 @@ void steadyLight(int position, struct Light * l)
 	(*l).gUpdate = 0;
 	(*l).bUpdate = 0;
 	(*l).colourSpeed = 0;
-	(*l).flickerSpeed = 0;
+	(*l).flickerUpdate = 0;
 	(*l).flickerBrightness = 255;
 	(*l).lightState = lightStateSteady;
+	(*l).transitioning = 0;
+	setLightChanged(l - lights);
 }
 
 void colouredSteadyLight(byte r, byte g, byte b, int position, struct Light * l)
@@ -278,16 +1211,14 @@ void colouredSteadyLight(byte r, byte g, byte b, int position, struct Light * l)
 
 void setLightColor(byte r, byte g, byte b, byte lightNo)
 {
-	colouredSteadyLight(r, g, b, lightNo*NO_OF_GAPS, &lights[lightNo]);
+	colouredSteadyLight(r, g, b, lightHomePosition(lightNo), &lights[lightNo]);
 }
 
 void flickeringLight(byte flickerBrightness, byte flickerUpdate, byte flickerMin, byte flickerMax, byte flickerSpeed, int position, struct Light * l)
 {
 	(*l).flickerBrightness = flickerBrightness;
 	(*l).flickerUpdate = flickerUpdate;
-	(*l).flickerMin = flickerMin;
-	(*l).flickerMax = flickerMax;
-	(*l).flickerSpeed = flickerSpeed;
+	(*l).flickerBlock = findFlickerBlock(l - lights, flickerSpeed, flickerMin, flickerMax);
 	(*l).pos = position;
 	(*l).moveSpeed = 0;
 	(*l).rUpdate = 0;
@@ -295,6 +1226,8 @@ void flickeringLight(byte flickerBrightness, byte flickerUpdate, byte flickerMin
 	(*l).bUpdate = 0;
 	(*l).colourSpeed = 0;
 	(*l).lightState = lightStateFlickerFixed;
+	(*l).transitioning = 0;
+	setLightChanged(l - lights);
 }
 
 void colouredFlickeringLight(byte r, byte g, byte b, byte flickerBrightness, byte flickerUpdate, byte flickerMin, byte flickerMax, byte flickerSpeed, int position, struct Light * l)
@@ -305,23 +1238,171 @@ void colouredFlickeringLight(byte r, byte g, byte b, byte flickerBrightness, byt
 	flickeringLight(flickerBrightness, flickerUpdate, flickerMin, flickerMax, flickerSpeed, position, l);
 }
 
-void renderLights()
+void drawSegment(byte s)
 {
-	for (uint16_t i = 0; i < strip.numPixels(); i++) {
-		strip.setPixelColor(i, 0, 0, 0);
-	}
+	struct Segment * seg = &segments[s];
 
-	for (int i = 0; i < NO_OF_LIGHTS; i++)
+	clearSegmentPixels(seg);
+
+	for (byte i = seg->firstLight; i < seg->lightLimit; i++)
 	{
-		renderLight(i);
+		renderLight(i, seg);
 	}
+}
 
+void showLights()
+{
 	strip.show();
+
+#ifdef DUMP_FRAMES
+	dumpFrame();
+#endif
+}
+
+/////////////////////////////////////////////
+//
+//  Colour transitions
+//
+/////////////////////////////////////////////
+
+// A transition fades lights from their current colour to a target colour. 
+// All the lights in a segment share the transition clock of the segment, 
+// which runs in real time, so every channel of every light reaches its 
+// target on the same frame. 
+// Progress is held in 8.8 fixed point, where 256 is the end of the 
+// transition, and is shaped by a curve before it is applied to the colours.
+
+enum transitionCurves
+{
+	curveLinear,
+	curveEaseIn,        // start slowly and speed up
+	curveEaseOut,       // start quickly and slow down
+	curveEaseInOut,     // slow at both ends
+	curveExponential    // double in speed every eighth of the transition
+};
+
+uint16_t applyTransitionCurve(uint16_t t, byte curve)
+{
+	if (t == 0)
+		return 0;
+
+	if (t >= 256)
+		return 256;
+
+	switch (curve)
+	{
+	case curveEaseIn:
+		return (t * t) >> 8;
+
+	case curveEaseOut:
+		t = 256 - t;
+		return 256 - ((t * t) >> 8);
+
+	case curveEaseInOut:
+		// smoothstep, 3t^2 - 2t^3
+		return (uint16_t)(((uint32_t)t * t * (768 - 2 * t)) >> 16);
+
+	case curveExponential:
+	{
+		// 2 to the power 8t, with the fraction of each power of two 
+		// filled in with a straight line, scaled back to 0 to 256
+		uint16_t power = t * 8;
+		uint32_t level = (uint32_t)(256 + (power & 0xFF)) << (power >> 8);
+		return (uint16_t)((level - 256) / 255);
+	}
+
+	default:
+		return t;
+	}
+}
+
+// Starts the transition clock of the active segment. The lights to move 
+// are then added with startLightTransition. 
+
+void startTransition(unsigned long time, byte curve)
+{
+	struct Segment * seg = &segments[activeSegment];
+
+	if (time == 0)
+		time = 1;
+
+	if (curve > curveExponential)
+		curve = curveLinear;
+
+	seg->transitionStartMillis = millis();
+	seg->transitionMillis = time;
+	seg->transitionCurve = curve;
+	seg->transitionLevel = 0;
+	seg->transitionRunning = true;
+}
+
+// Called by updateSegment before the lights in the segment are updated. 
+// On the frame that the clock runs out the level is 256 and 
+// transitionRunning is cleared, so the lights land on their targets and 
+// leave the transition.
+
+void updateTransitionClock(struct Segment * seg)
+{
+	if (!seg->transitionRunning)
+		return;
+
+	unsigned long elapsed = millis() - seg->transitionStartMillis;
+
+	uint16_t t;
+
+	if (elapsed >= seg->transitionMillis)
+	{
+		t = 256;
+		seg->transitionRunning = false;
+	}
+	else
+	{
+		t = (uint16_t)((elapsed << 8) / seg->transitionMillis);
+	}
+
+	seg->transitionLevel = applyTransitionCurve(t, seg->transitionCurve);
+}
+
+inline byte transitionComponent(byte start, byte target, uint16_t level)
+{
+	if (target >= start)
+		return start + (((uint16_t)(target - start) * level) >> 8);
+	return start - (((uint16_t)(start - target) * level) >> 8);
+}
+
+// Called with the segment that holds the light active
+
+void updateLightTransition(byte i)
+{
+	struct Segment * seg = &segments[activeSegment];
+
+	lights[i].r = transitionComponent(lights[i].rMin, lights[i].rMax, seg->transitionLevel);
+	lights[i].g = transitionComponent(lights[i].gMin, lights[i].gMax, seg->transitionLevel);
+	lights[i].b = transitionComponent(lights[i].bMin, lights[i].bMax, seg->transitionLevel);
+
+	if (!seg->transitionRunning)
+	{
+		// finished - hold the target colour
+		lights[i].rMin = lights[i].rMax;
+		lights[i].gMin = lights[i].gMax;
+		lights[i].bMin = lights[i].bMax;
+		lights[i].transitioning = 0;
+	}
 }
 
 void updateLightColours(byte i)
 {
-	if ((tickCount % lights[i].colourSpeed) != 0 || lights[i].colourSpeed == 0)
+	// the hue cycle state holds its settings where the colour limits would be
+	if (lights[i].lightState == lightStateHueCycle)
+		return;
+
+	if (lights[i].transitioning)
+	{
+		updateLightTransition(i);
+		return;
+	}
+
+	if (lights[i].colourSpeed == 0 || (tickCount % lights[i].colourSpeed) != 0)
 		return;
 
 	/// going to 'bounce' the colours when they hit the endstops
@@ -514,32 +1595,78 @@ void updateLightColours(byte i)
 	}
 }
 
+// True if the active segment is not in a transition
+
 bool transitionComplete()
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
-	{
-		if (lights[i].rUpdate != 0 || lights[i].gUpdate != 0 || lights[i].bUpdate != 0)
-			return 0;
-	}
-	return 1;
+	return !segments[activeSegment].transitionRunning;
 }
 
+// Called with the segment that holds the light active. The range of a 
+// moving light defaults to the whole segment and is kept inside it.
+
 void updateLightPosition(byte i)
 {
-	if ((tickCount % lights[i].moveSpeed) != 0 || lights[i].moveSpeed == 0)
+	if (lights[i].moveSpeed == 0 || lights[i].moveDist == 0)
 		return;
 
-	lights[i].pos += lights[i].moveSpeed;
+	if ((tickCount % lights[i].moveSpeed) != 0)
+		return;
+
+	int low = lights[i].posMin;
+	int high = lights[i].posMax;
+
+	int segmentLow = segments[activeSegment].firstPixel * NO_OF_GAPS;
+	int segmentHigh = segments[activeSegment].pixelLimit * NO_OF_GAPS;
 
-	if (lights[i].pos >= PIXELS*NO_OF_GAPS)
+	if (lights[i].moveMode == moveBounce)
 	{
-		lights[i].pos -= (PIXELS*NO_OF_GAPS);
-	}
-	else {
-		if (lights[i].pos < 0)
+		// Bounce between the ends of the range. The light must not go past 
+		// the last pixel, otherwise it would be drawn across the join in the ring
+		if (high <= low || high > segmentHigh - NO_OF_GAPS)
+			high = segmentHigh - NO_OF_GAPS;
+		if (low < segmentLow || low > high)
+			low = segmentLow;
+
+		int pos = lights[i].pos + lights[i].moveDist;
+
+		if (pos > high)
+		{
+			pos = high - (pos - high);
+			lights[i].moveDist = -lights[i].moveDist;
+		}
+		else
 		{
-			lights[i].pos += (PIXELS*NO_OF_GAPS);
+			if (pos < low)
+			{
+				pos = low + (low - pos);
+				lights[i].moveDist = -lights[i].moveDist;
+			}
 		}
+
+		// a very short range might be crossed in a single move
+		if (pos > high) pos = high;
+		if (pos < low) pos = low;
+
+		lights[i].pos = pos;
+	}
+	else
+	{
+		// Wrap round within the range
+		if (high <= low || high > segmentHigh)
+			high = segmentHigh;
+		if (low < segmentLow || low >= high)
+			low = segmentLow;
+
+		int span = high - low;
+		int pos = lights[i].pos + lights[i].moveDist;
+
+		while (pos >= high)
+			pos -= span;
+		while (pos < low)
+			pos += span;
+
+		lights[i].pos = pos;
 	}
 }
 
@@ -558,254 +1685,462 @@ void setFlickerUpdateSpeed(byte speed)
 
 }
 
-void updateLightFlicker(byte i)
+// Flickering lights read their brightness from a table of smoothed noise 
+// rather than calling random on every tick. Each light starts at a 
+// different point in the table so that the lights do not flicker together.
+// The position in the table is worked out from the tick count, so the 
+// flicker is the same every time it is run. 
+
+const byte flickerNoise[256] PROGMEM = {
+	191, 232, 227, 175, 138, 159, 185, 207, 225, 235, 244, 242, 221, 211, 207, 166,
+	125, 142, 188, 223, 231, 218, 202, 190, 179, 193, 230, 245, 234, 194, 154, 147,
+	165, 187, 210, 228, 229, 225, 232, 234, 223, 218, 236, 249, 250, 228, 166, 148,
+	172, 168, 183, 229, 243, 238, 242, 251, 254, 251, 239, 241, 250, 244, 214, 175,
+	143, 159, 204, 227, 243, 252, 254, 251, 228, 159, 103,  76,  67,  98, 130, 153,
+	202, 238, 237, 225, 237, 245, 239, 231, 213, 189, 197, 216, 212, 199, 225, 252,
+	255, 254, 235, 231, 253, 255, 249, 207, 205, 241, 252, 253, 250, 238, 217, 199,
+	190, 215, 245, 251, 246, 236, 211, 170, 160, 191, 216, 224, 229, 239, 246, 241,
+	218, 215, 245, 255, 255, 254, 243, 200, 198, 245, 254, 247, 203, 152, 131, 151,
+	184, 171,  97,  38,  76, 151, 204, 237, 253, 255, 255, 255, 254, 250, 246, 248,
+	236, 202, 203, 229, 221, 155, 100, 167, 241, 255, 255, 247, 216, 179, 175, 223,
+	249, 240, 199, 209, 244, 243, 214, 197, 209, 225, 235, 238, 230, 180, 107, 143,
+	211, 222, 198, 195, 228, 252, 255, 255, 253, 251, 253, 254, 248, 235, 240, 252,
+	255, 255, 245, 221, 228, 251, 255, 255, 255, 255, 254, 254, 249, 234, 232, 247,
+	250, 240, 226, 193, 104,  59, 125, 161, 116,  80, 170, 236, 235, 193, 181, 221,
+	245, 246, 228, 197, 178, 190, 228, 248, 245, 216, 186, 169, 116,  53,  66, 124
+};
+
+// Offset into the noise table between one light and the next
+#define FLICKER_PHASE_SPREAD 0x2B70
+
+// Number of steps between each entry in the noise table
+// The flicker update of a light gives the steps it moves on each update
+#define FLICKER_NOISE_STEPS 16
+
+// Reads the noise table at a phase, blending between neighbouring entries
+
+byte flickerNoiseAt(uint16_t phase)
 {
-	if (lights[i].flickerSpeed == 0)
-		return;
+	byte index = phase / FLICKER_NOISE_STEPS;
+	byte fraction = phase % FLICKER_NOISE_STEPS;
+
+	int first = pgm_read_byte(&flickerNoise[index]);
+	int second = pgm_read_byte(&flickerNoise[(byte)(index + 1)]);
+
+	return first + (((second - first) * fraction) / FLICKER_NOISE_STEPS);
+}
+
+// Gives a flicker update step for a light from the flicker range. 
+// The faster the flicker update speed the larger the step.
+
+int8_t flickerStep(byte lightNo, byte flickerMin, byte flickerMax)
+{
+	uint16_t step = 0;
+
+	if (flickerMax > flickerMin)
+		step = (flickerMax - flickerMin) / flickerUpdateSpeed;
 
+	// vary the step from light to light. This is unsigned as 255 * 255 
+	// would overflow an int on the AVR. The step is at least 1.
+	step = 1 + ((step * flickerNoiseAt((uint16_t)lightNo * FLICKER_PHASE_SPREAD)) >> 8);
+
+	if (step > 127)
+		step = 127;
+
+	return (int8_t)step;
+}
+
+// Gives the brightness of a light in the flicker range for the current tick
+
+byte flickerLevel(byte lightNo, int8_t flickerUpdate, byte flickerMin, byte flickerMax)
+{
+	byte step = flickerUpdate < 0 ? -flickerUpdate : flickerUpdate;
+
+	uint16_t phase = (uint16_t)tickCount * step + (uint16_t)lightNo * FLICKER_PHASE_SPREAD;
+
+	byte noise = flickerNoiseAt(phase);
+
+	return flickerMin + (((uint16_t)(flickerMax - flickerMin) * noise) >> 8);
+}
+
+void updateLightFlicker(byte i)
+{
 	if (lights[i].flickerUpdate == 0) 
 		return; // quit if not flickering
 
-	if ((tickCount % lights[i].flickerSpeed) != 0)
+	struct FlickerBlock * flicker = &flickerBlocks[lights[i].flickerBlock];
+
+	if ((*flicker).speed == 0)
+		return;
+
+	if ((tickCount % (*flicker).speed) != 0)
 		return;
 
-	/// going to 'bounce' the flicker when it hits the endstops
-	int temp = lights[i].flickerBrightness;
+	lights[i].flickerBrightness = flickerLevel(i, lights[i].flickerUpdate, 
+		(*flicker).min, (*flicker).max);
+}
+
+/////////////////////////////////////////////
+//
+//  HSV colours
+//
+/////////////////////////////////////////////
+
+// Hue runs from 0 to HUE_RANGE-1 round the colour wheel. There are 256 
+// steps between each of the six primary and secondary colours, which 
+// means the conversion only needs shifts and multiplies.
+// Red is 0, yellow 256, green 512, cyan 768, blue 1024 and magenta 1280.
 
-	temp += lights[i].flickerUpdate;
+#define HUE_RANGE 1536
 
-	if (temp <= lights[i].flickerMin)
-	{ 
-		// clamp the value at the lower limit
-		lights[i].flickerBrightness = lights[i].flickerMin;
+void hsvToRgb(uint16_t hue, byte saturation, byte value, byte *r, byte *g, byte *b)
+{
+	byte sector = hue >> 8;
+	byte fraction = hue & 0xFF;
+
+	// colour components that are falling, rising and at the floor
+	byte lowest = ((uint16_t)value * (256 - saturation)) >> 8;
+	byte falling = ((uint16_t)value * (256 - (((uint16_t)saturation * fraction) >> 8))) >> 8;
+	byte rising = ((uint16_t)value * (256 - (((uint16_t)saturation * (256 - fraction)) >> 8))) >> 8;
 
-		// reverse direction
-		lights[i].flickerUpdate = -lights[i].flickerUpdate;
+	switch (sector)
+	{
+	case 0:
+		(*r) = value; (*g) = rising; (*b) = lowest;
+		break;
+	case 1:
+		(*r) = falling; (*g) = value; (*b) = lowest;
+		break;
+	case 2:
+		(*r) = lowest; (*g) = value; (*b) = rising;
+		break;
+	case 3:
+		(*r) = lowest; (*g) = falling; (*b) = value;
+		break;
+	case 4:
+		(*r) = rising; (*g) = lowest; (*b) = value;
+		break;
+	default:
+		(*r) = value; (*g) = lowest; (*b) = falling;
+		break;
+	}
+}
 
-		// The faster the flicker rate, the more likely a change
-		if (random(0, flickerUpdateSpeed/2) < 2)
+// Converts a hue in degrees into the hue range
+
+uint16_t hueFromDegrees(int degrees)
+{
+	degrees = degrees % 360;
+	if (degrees < 0)
+		degrees += 360;
+	return (uint16_t)(((long)degrees * HUE_RANGE) / 360);
+}
+
+void setLightColourFromHsv(struct Light * l)
+{
+	hsvToRgb((*l).hue, (*l).saturation, (*l).value, &(*l).r, &(*l).g, &(*l).b);
+}
+
+// Sets a light to a colour given as hue, saturation and value
+// The light moves round the colour wheel by hueUpdate every colourSpeed ticks
+
+void hueLight(uint16_t hue, int8_t hueUpdate, byte saturation, byte value, byte colourSpeed, int position, struct Light * l)
+{
+	steadyLight(position, l);
+	(*l).hue = hue % HUE_RANGE;
+	(*l).hueUpdate = hueUpdate;
+	(*l).saturation = saturation;
+	(*l).saturationUpdate = 0;
+	(*l).value = value;
+	(*l).valueUpdate = 0;
+	(*l).colourSpeed = colourSpeed;
+	(*l).lightState = lightStateHueCycle;
+	setLightColourFromHsv(l);
+}
+
+// 'bounce' a value between 0 and 255
+
+void bounceByte(byte * value, int8_t * update)
+{
+	int temp = *value;
+	temp += *update;
+
+	if (temp <= 0)
+	{
+		*value = 0;
+		*update = -*update;
+	}
+	else
+	{
+		if (temp >= 255)
+		{
+			*value = 255;
+			*update = -*update;
+		}
+		else
 		{
-			// change the flicker speed
-			lights[i].flickerUpdate = random(1, (int)(lights[i].flickerMax - lights[i].flickerMin) / flickerUpdateSpeed);
+			*value = (byte)temp;
 		}
 	}
-	else {
-		if (temp >= lights[i].flickerMax)
+}
+
+void updateLightHue(byte i)
+{
+	if (lights[i].lightState != lightStateHueCycle)
+		return;
+
+	if (lights[i].colourSpeed == 0 || (tickCount % lights[i].colourSpeed) != 0)
+		return;
+
+	if (lights[i].hueUpdate != 0)
+	{
+		int temp = lights[i].hue;
+		temp += lights[i].hueUpdate;
+
+		if (temp >= HUE_RANGE)
 		{
-			// just clamp and reverse
-			lights[i].flickerBrightness = lights[i].flickerMax;
-			lights[i].flickerUpdate = -lights[i].flickerUpdate;
+			temp -= HUE_RANGE;
 		}
 		else
 		{
-			lights[i].flickerBrightness = (byte)temp;
+			if (temp < 0)
+				temp += HUE_RANGE;
 		}
+		lights[i].hue = temp;
 	}
+
+	if (lights[i].saturationUpdate != 0)
+		bounceByte(&lights[i].saturation, &lights[i].saturationUpdate);
+
+	if (lights[i].valueUpdate != 0)
+		bounceByte(&lights[i].value, &lights[i].valueUpdate);
+
+	setLightColourFromHsv(&lights[i]);
 }
 
-// Start the transition of a light to a new colour
+// Adds a light to the transition started by startTransition. The light 
+// keeps flickering while it fades from its current colour to the new one.
 
-void startLightTransition(byte lightNo, byte speed, byte colourSpeed, byte r, byte g, byte b)
+void startLightTransition(byte lightNo, byte r, byte g, byte b)
 {
+	byte flickerMin = flickerBlocks[lights[lightNo].flickerBlock].min;
+	byte flickerMax = flickerBlocks[lights[lightNo].flickerBlock].max;
 
 	colouredFlickeringLight(
 		lights[lightNo].r, lights[lightNo].g, lights[lightNo].b,     // colour
-		random(1, lights[lightNo].flickerMax - lights[lightNo].flickerMin),//60,            // flicker brightness
-		random(1, (int)(lights[lightNo].flickerMax - lights[lightNo].flickerMin) / flickerUpdateSpeed),            // flicker update step
-		lights[lightNo].flickerMin,            // flicker minimum
-		lights[lightNo].flickerMax,           // flicker maximum
+		flickerLevel(lightNo, 1, flickerMin, flickerMax),            // flicker brightness
+		flickerStep(lightNo, flickerMin, flickerMax),            // flicker update step
+		flickerMin,            // flicker minimum
+		flickerMax,           // flicker maximum
 		1,             // number of ticks per flicker update - flicker speed
-		NO_OF_GAPS*lightNo,  // position on the ring
+		lightHomePosition(lightNo),  // position on the ring
 		&lights[lightNo]);   // ligit to make flicker
 
-	lights[lightNo].colourSpeed = colourSpeed;
-	lights[lightNo].rMin = r;
+	lights[lightNo].rMin = lights[lightNo].r;
 	lights[lightNo].rMax = r;
-
-	if (lights[lightNo].r > r)
-	{
-		lights[lightNo].rUpdate = (int8_t)-((lights[lightNo].r - r) / speed);
-		if (lights[lightNo].rUpdate == 0) lights[lightNo].rUpdate = -1;
-	}
-	else
-	{
-		lights[lightNo].rUpdate = (int8_t)((r - lights[lightNo].r) / speed);
-		if (lights[lightNo].rUpdate == 0) lights[lightNo].rUpdate = 1;
-	}
-
-	lights[lightNo].gMin = g;
+	lights[lightNo].gMin = lights[lightNo].g;
 	lights[lightNo].gMax = g;
-
-	if (lights[lightNo].g > g)
-	{
-		lights[lightNo].gUpdate = (int8_t)-((lights[lightNo].g - g) / speed);
-		if (lights[lightNo].gUpdate == 0) lights[lightNo].gUpdate = -1;
-	}
-	else
-	{
-		lights[lightNo].gUpdate = (int8_t)((g - lights[lightNo].g) / speed);
-		if (lights[lightNo].gUpdate == 0) lights[lightNo].gUpdate = 1;
-	}
-
-	lights[lightNo].bMin = b;
+	lights[lightNo].bMin = lights[lightNo].b;
 	lights[lightNo].bMax = b;
-
-	if (lights[lightNo].b > b)
-	{
-		lights[lightNo].bUpdate = (int8_t)-((lights[lightNo].b - b) / speed);
-		if (lights[lightNo].bUpdate == 0) lights[lightNo].bUpdate = -1;
-	}
-	else
-	{
-		lights[lightNo].bUpdate = (int8_t)((b - lights[lightNo].b) / speed);
-		if (lights[lightNo].bUpdate == 0) lights[lightNo].bUpdate = 1;
-	}
+	lights[lightNo].transitioning = 1;
 }
 
-/* Colour Codes
-
-Alice Blue,240,248,255,#f0f8ff
-Antique White,250,235,215,#faebd7
-Aqua,0,255,255,#00ffff
-Aquamarine,127,255,212,#7fffd4
-Azure,240,255,255,#f0ffff
-Beige,245,245,220,#f5f5dc
-Bisque,255,228,196,#ffe4c4
-Black* 0,0,0,#000000
-Blanched Almond,255,235,205,#ffebcd
-Blue*,0,0,255,#0000ff
-Blue-Violet,138,43,226,#8a2be2
-Brown,165,42,42,#a52a2a
-Burlywood,222,184,135,#deb887
-Cadet Blue,95,158,160,#5f9ea0
-Chartreuse,127,255,0,#7fff00
-Chocolate,210,105,30,#d2691e
-Coral,255,127,80,#ff7f50
-Cornflower Blue,100,149,237,#6495ed
-Cornsilk,255,248,220,#fff8dc
-Cyan,0,255,255,#00ffff
-Dark Blue,0,0,139,#00008b
-Dark Cyan,0,139,139,#008b8b
-Dark Goldenrod,184,134,11,#b8860b
-Dark Gray,169,169,169,#a9a9a9
-Dark Green,0,100,0,#006400
-Dark Khaki,189,183,107,#bdb76b
-Dark Magenta,139,0,139,#8b008b
-Dark Olive Green,85,107,47,#556b2f
-Dark Orange,255,140,0,#ff8c00
-Dark Orchid,153,50,204,#9932cc
-Dark Red,139,0,0,#8b0000
-Dark Salmon,233,150,122,#e9967a
-Dark Sea Green,143,188,143,#8fbc8f
-Dark Slate Blue,72,61,139,#483d8b
-Dark Slate Gray,47,79,79,#2f4f4f
-Dark Turquoise,0,206,209,#00ced1
-Dark Violet,148,0,211,#9400d3
-Deep Pink,255,20,147,#ff1493
-Deep Sky Blue,0,191,255,#00bfff
-Dim Gray,105,105,105,#696969
-Dodger Blue,30,144,255,#1e90ff
-Firebrick,178,34,34,#b22222
-Floral White,255,250,240,#fffaf0
-Forest Green,34,139,34,#228b22
-Fuschia* 255,0,255,#ff00ff
-Gainsboro,220,220,220,#dcdcdc
-Ghost White,255,250,250,#f8f8ff
-Gold,255,215,0,#ffd700
-Goldenrod,218,165,32,#daa520
-Gray*,128,128,128,#808080
-Green* 0,128,0,#008000
-Green-Yellow,173,255,47,#adff2f
-Honeydew,240,255,240,#f0fff0
-Hot Pink,255,105,180,#ff69b4
-Indian Red,205,92,92,#cd5c5c
-Ivory,255,255,240,#fffff0
-Khaki,240,230,140,#f0e68c
-Lavender,230,230,250,#e6e6fa
-Lavender Blush,255,240,245,#fff0f5
-Lawn Green,124,252,0,#7cfc00
-Lemon Chiffon,255,250,205,#fffacd
-Light Blue,173,216,230,#add8e6
-Light Coral,240,128,128,#f08080
-Light Cyan,224,255,255,#e0ffff
-Light Goldenrod,238,221,130,#eedd82
-Light Goldenrod Yellow,250,250,210,#fafad2
-Light Gray,211,211,211,#d3d3d3
-Light Green,144,238,144,#90ee90
-Light Pink,255,182,193,#ffb6c1
-Light Salmon,255,160,122,#ffa07a
-Light Sea Green,32,178,170,#20b2aa
-Light Sky Blue,135,206,250,#87cefa
-Light Slate Blue,132,112,255,#8470ff
-Light Slate Gray,119,136,153,#778899
-Light Steel Blue,176,196,222,#b0c4de
-Light Yellow,255,255,224,#ffffe0
-Lime*,0,255,0,#00ff00
-Lime Green,50,205,50,#32cd32
-Linen,250,240,230,#faf0e6
-Magenta,255,0,255,#ff00ff
-Maroon* 128,0,0,#800000
-Medium Aquamarine,102,205,170,#66cdaa
-Medium Blue,0,0,205,#0000cd
-Medium Orchid,186,85,211,#ba55d3
-Medium Purple,147,112,219,#9370db
-Medium Sea Green,60,179,113,#3cb371
-Medium Slate Blue,123,104,238,#7b68ee
-Medium Spring Green,0,250,154,#00fa9a
-Medium Turquoise,72,209,204,#48d1cc
-Medium Violet-Red,199,21,133,#c71585
-Midnight Blue,25,25,112,#191970
-Mint Cream,245,255,250,#f5fffa
-Misty Rose,255,228,225,#e1e4e1
-Moccasin,255,228,181,#ffe4b5
-Navajo White,255,222,173,#ffdead
-Navy*,0,0,128,#000080
-Old Lace,253,245,230,#fdf5e6
-Olive* 128,128,0,#808000
-Olive Drab,107,142,35,#6b8e23
-Orange,255,165,0,#ffa500
-Orange-Red,255,69,0,#ff4500
-Orchid,218,112,214,#da70d6
-Pale Goldenrod,238,232,170,#eee8aa
-Pale Green,152,251,152,#98fb98
-Pale Turquoise,175,238,238,#afeeee
-Pale Violet-Red,219,112,147,#db7093
-Papaya Whip,255,239,213,#ffefd5
-Peach Puff,255,218,185,#ffdab9
-Peru,205,133,63,#cd853f
-Pink,255,192,203,#ffc0cb
-Plum,221,160,221,#dda0dd
-Powder Blue,176,224,230,#b0e0e6
-Purple* 128,0,128,#800080
-Red*,255,0,0,#ff0000
-Rosy Brown,188,143,143,#bc8f8f
-Royal Blue,65,105,225,#4169e1
-Saddle Brown,139,69,19,#8b4513
-Salmon,250,128,114,#fa8072
-Sandy Brown,244,164,96,#f4a460
-Sea Green,46,139,87,#2e8b57
-Seashell,255,245,238,#fff5ee
-Sienna,160,82,45,#a0522d
-Silver* 192,192,192,#c0c0c0
-Sky Blue,135,206,235,#87ceeb
-Slate Blue,106,90,205,#6a5acd
-Slate Gray,112,128,144,#708090
-Snow,255,250,250,#fffafa
-Spring Green,0,255,127,#00ff7f
-Steel Blue,70,130,180,#4682b4
-Tan,210,180,140,#d2b48c
-Teal*,0,128,128,#008080
-Thistle,216,191,216,#d8bfd8
-Tomato,255,99,71,#ff6347
-Turquoise,64,224,208,#40e0d0
-Violet,238,130,238,#ee82ee
-Violet-Red,208,32,144,#d02090
-Wheat,245,222,179,#f5deb3
-White* 255,255,255,#ffffff
-White Smoke,245,245,245,#f5f5f5
-Yellow* 255,255,0,#ffff00
-Yellow-Green,154,205,50,#9acd32,
-*/
+/////////////////////////////////////////////
+//
+//  Named colours
+//
+/////////////////////////////////////////////
+
+// The colour names are held as a single string in program memory, in the 
+// same order as the colour values. Names are lower case with the spaces 
+// and hyphens removed. 
+// The robot colours come first, in the order of the lightColor values, so 
+// a lightColor is its own position in the table. The rest of the web 
+// colour names only fit in flash when there is room to spare, so they are 
+// only included when FULL_COLOUR_TABLE is defined. Web colours with the 
+// same name as a robot colour are left out, the robot colour is used.
+
+//#define FULL_COLOUR_TABLE
+
+const char colourNames[] PROGMEM = 
+	"red,blue,green,lilac,cyan,pink,lavender,plum,lime,orange,powderblue,"
+	"purple,teal"
+#ifdef FULL_COLOUR_TABLE
+	",aliceblue,antiquewhite,aqua,aquamarine,azure,beige,bisque,black,"
+	"blanchedalmond,blueviolet,brown,burlywood,cadetblue,chartreuse,"
+	"chocolate,coral,cornflowerblue,cornsilk,darkblue,darkcyan,"
+	"darkgoldenrod,darkgray,darkgreen,darkkhaki,darkmagenta,"
+	"darkolivegreen,darkorange,darkorchid,darkred,darksalmon,"
+	"darkseagreen,darkslateblue,darkslategray,darkturquoise,darkviolet,"
+	"deeppink,deepskyblue,dimgray,dodgerblue,firebrick,floralwhite,"
+	"forestgreen,fuschia,gainsboro,ghostwhite,gold,goldenrod,gray,"
+	"greenyellow,honeydew,hotpink,indianred,ivory,khaki,lavenderblush,"
+	"lawngreen,lemonchiffon,lightblue,lightcoral,lightcyan,"
+	"lightgoldenrod,lightgoldenrodyellow,lightgray,lightgreen,lightpink,"
+	"lightsalmon,lightseagreen,lightskyblue,lightslateblue,"
+	"lightslategray,lightsteelblue,lightyellow,limegreen,linen,magenta,"
+	"maroon,mediumaquamarine,mediumblue,mediumorchid,mediumpurple,"
+	"mediumseagreen,mediumslateblue,mediumspringgreen,mediumturquoise,"
+	"mediumvioletred,midnightblue,mintcream,mistyrose,moccasin,"
+	"navajowhite,navy,oldlace,olive,olivedrab,orangered,orchid,"
+	"palegoldenrod,palegreen,paleturquoise,palevioletred,papayawhip,"
+	"peachpuff,peru,rosybrown,royalblue,saddlebrown,salmon,sandybrown,"
+	"seagreen,seashell,sienna,silver,skyblue,slateblue,slategray,snow,"
+	"springgreen,steelblue,tan,thistle,tomato,turquoise,violet,violetred,"
+	"wheat,white,whitesmoke,yellow,yellowgreen"
+#endif
+	;
+
+const byte colourValues[][3] PROGMEM = {
+	{ 255, 0, 0 }, // red
+	{ 0, 0, 255 }, // blue
+	{ 0, 255, 0 }, // green
+	{ 220, 208, 255 }, // lilac
+	{ 0, 255, 255 }, // cyan
+	{ 255, 105, 180 }, // pink
+	{ 230, 230, 250 }, // lavender
+	{ 221, 160, 221 }, // plum
+	{ 50, 205, 50 }, // lime
+	{ 255, 165, 0 }, // orange
+	{ 176, 224, 230 }, // powderblue
+	{ 128, 0, 128 }, // purple
+	{ 0, 128, 128 }, // teal
+#ifdef FULL_COLOUR_TABLE
+	{ 240, 248, 255 }, // aliceblue
+	{ 250, 235, 215 }, // antiquewhite
+	{ 0, 255, 255 }, // aqua
+	{ 127, 255, 212 }, // aquamarine
+	{ 240, 255, 255 }, // azure
+	{ 245, 245, 220 }, // beige
+	{ 255, 228, 196 }, // bisque
+	{ 0, 0, 0 }, // black
+	{ 255, 235, 205 }, // blanchedalmond
+	{ 138, 43, 226 }, // blueviolet
+	{ 165, 42, 42 }, // brown
+	{ 222, 184, 135 }, // burlywood
+	{ 95, 158, 160 }, // cadetblue
+	{ 127, 255, 0 }, // chartreuse
+	{ 210, 105, 30 }, // chocolate
+	{ 255, 127, 80 }, // coral
+	{ 100, 149, 237 }, // cornflowerblue
+	{ 255, 248, 220 }, // cornsilk
+	{ 0, 0, 139 }, // darkblue
+	{ 0, 139, 139 }, // darkcyan
+	{ 184, 134, 11 }, // darkgoldenrod
+	{ 169, 169, 169 }, // darkgray
+	{ 0, 100, 0 }, // darkgreen
+	{ 189, 183, 107 }, // darkkhaki
+	{ 139, 0, 139 }, // darkmagenta
+	{ 85, 107, 47 }, // darkolivegreen
+	{ 255, 140, 0 }, // darkorange
+	{ 153, 50, 204 }, // darkorchid
+	{ 139, 0, 0 }, // darkred
+	{ 233, 150, 122 }, // darksalmon
+	{ 143, 188, 143 }, // darkseagreen
+	{ 72, 61, 139 }, // darkslateblue
+	{ 47, 79, 79 }, // darkslategray
+	{ 0, 206, 209 }, // darkturquoise
+	{ 148, 0, 211 }, // darkviolet
+	{ 255, 20, 147 }, // deeppink
+	{ 0, 191, 255 }, // deepskyblue
+	{ 105, 105, 105 }, // dimgray
+	{ 30, 144, 255 }, // dodgerblue
+	{ 178, 34, 34 }, // firebrick
+	{ 255, 250, 240 }, // floralwhite
+	{ 34, 139, 34 }, // forestgreen
+	{ 255, 0, 255 }, // fuschia
+	{ 220, 220, 220 }, // gainsboro
+	{ 255, 250, 250 }, // ghostwhite
+	{ 255, 215, 0 }, // gold
+	{ 218, 165, 32 }, // goldenrod
+	{ 128, 128, 128 }, // gray
+	{ 173, 255, 47 }, // greenyellow
+	{ 240, 255, 240 }, // honeydew
+	{ 255, 105, 180 }, // hotpink
+	{ 205, 92, 92 }, // indianred
+	{ 255, 255, 240 }, // ivory
+	{ 240, 230, 140 }, // khaki
+	{ 255, 240, 245 }, // lavenderblush
+	{ 124, 252, 0 }, // lawngreen
+	{ 255, 250, 205 }, // lemonchiffon
+	{ 173, 216, 230 }, // lightblue
+	{ 240, 128, 128 }, // lightcoral
+	{ 224, 255, 255 }, // lightcyan
+	{ 238, 221, 130 }, // lightgoldenrod
+	{ 250, 250, 210 }, // lightgoldenrodyellow
+	{ 211, 211, 211 }, // lightgray
+	{ 144, 238, 144 }, // lightgreen
+	{ 255, 182, 193 }, // lightpink
+	{ 255, 160, 122 }, // lightsalmon
+	{ 32, 178, 170 }, // lightseagreen
+	{ 135, 206, 250 }, // lightskyblue
+	{ 132, 112, 255 }, // lightslateblue
+	{ 119, 136, 153 }, // lightslategray
+	{ 176, 196, 222 }, // lightsteelblue
+	{ 255, 255, 224 }, // lightyellow
+	{ 50, 205, 50 }, // limegreen
+	{ 250, 240, 230 }, // linen
+	{ 255, 0, 255 }, // magenta
+	{ 128, 0, 0 }, // maroon
+	{ 102, 205, 170 }, // mediumaquamarine
+	{ 0, 0, 205 }, // mediumblue
+	{ 186, 85, 211 }, // mediumorchid
+	{ 147, 112, 219 }, // mediumpurple
+	{ 60, 179, 113 }, // mediumseagreen
+	{ 123, 104, 238 }, // mediumslateblue
+	{ 0, 250, 154 }, // mediumspringgreen
+	{ 72, 209, 204 }, // mediumturquoise
+	{ 199, 21, 133 }, // mediumvioletred
+	{ 25, 25, 112 }, // midnightblue
+	{ 245, 255, 250 }, // mintcream
+	{ 255, 228, 225 }, // mistyrose
+	{ 255, 228, 181 }, // moccasin
+	{ 255, 222, 173 }, // navajowhite
+	{ 0, 0, 128 }, // navy
+	{ 253, 245, 230 }, // oldlace
+	{ 128, 128, 0 }, // olive
+	{ 107, 142, 35 }, // olivedrab
+	{ 255, 69, 0 }, // orangered
+	{ 218, 112, 214 }, // orchid
+	{ 238, 232, 170 }, // palegoldenrod
+	{ 152, 251, 152 }, // palegreen
+	{ 175, 238, 238 }, // paleturquoise
+	{ 219, 112, 147 }, // palevioletred
+	{ 255, 239, 213 }, // papayawhip
+	{ 255, 218, 185 }, // peachpuff
+	{ 205, 133, 63 }, // peru
+	{ 188, 143, 143 }, // rosybrown
+	{ 65, 105, 225 }, // royalblue
+	{ 139, 69, 19 }, // saddlebrown
+	{ 250, 128, 114 }, // salmon
+	{ 244, 164, 96 }, // sandybrown
+	{ 46, 139, 87 }, // seagreen
+	{ 255, 245, 238 }, // seashell
+	{ 160, 82, 45 }, // sienna
+	{ 192, 192, 192 }, // silver
+	{ 135, 206, 235 }, // skyblue
+	{ 106, 90, 205 }, // slateblue
+	{ 112, 128, 144 }, // slategray
+	{ 255, 250, 250 }, // snow
+	{ 0, 255, 127 }, // springgreen
+	{ 70, 130, 180 }, // steelblue
+	{ 210, 180, 140 }, // tan
+	{ 216, 191, 216 }, // thistle
+	{ 255, 99, 71 }, // tomato
+	{ 64, 224, 208 }, // turquoise
+	{ 238, 130, 238 }, // violet
+	{ 208, 32, 144 }, // violetred
+	{ 245, 222, 179 }, // wheat
+	{ 255, 255, 255 }, // white
+	{ 245, 245, 245 }, // whitesmoke
+	{ 255, 255, 0 }, // yellow
+	{ 154, 205, 50 }, // yellowgreen
+#endif
+};
+
+#define NO_OF_COLOURS (sizeof(colourValues) / sizeof(colourValues[0]))
+
+// Colours used by the robot. The values are positions in the colour table.
 
 enum lightColor
 {
@@ -824,181 +2159,85 @@ enum lightColor
 	teal
 };
 
-void selectColour(lightColor color, byte *r, byte *g, byte *b)
+// Random colour transitions pick from the robot colours
+#define NO_OF_ROBOT_COLOURS (teal + 1)
+
+// Reads a colour from the colour table. Returns false if there is no such colour.
+
+bool getColourFromTable(int colourNo, byte *r, byte *g, byte *b)
+{
+	if (colourNo < 0 || colourNo >= (int)NO_OF_COLOURS)
+		return false;
+
+	(*r) = pgm_read_byte(&colourValues[colourNo][0]);
+	(*g) = pgm_read_byte(&colourValues[colourNo][1]);
+	(*b) = pgm_read_byte(&colourValues[colourNo][2]);
+	return true;
+}
+
+// Finds a colour by name. The name can be in upper or lower case and ends 
+// with any character that is not a letter.
+// Returns the position of the colour in the table, or -1 if it is not found
+
+int findColourByName(const char * name)
 {
-	switch (color)
+	int colourNo = 0;
+	const char * namePos = name;
+	const char * tablePos = colourNames;
+
+	while (true)
 	{
-	case red: // red
-#ifdef SERIAL_VERBOSE
-		Serial.println("Red");
-#endif
-		(*r) = 255; (*g) = 0; (*b) = 0;
-		break;
-	case blue: // blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("Blue");
-#endif
-		(*r) = 0; (*g) = 0; (*b) = 255;
-		break;
-	case green: // green
-#ifdef SERIAL_VERBOSE
-		Serial.println("Green");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 0;
-		break;
-	case lilac: // lilac
-#ifdef SERIAL_VERBOSE
-		Serial.println("Lilac");
-#endif
-		(*r) = 220; (*g) = 208; (*b) = 255;
-		break;
-	case cyan: // cyan
-#ifdef SERIAL_VERBOSE
-		Serial.println("cyan");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 255;
-		break;
-	case pink: // hot pink
-#ifdef SERIAL_VERBOSE
-		Serial.println("hot pink");
-#endif
-		(*r) = 255; (*g) = 105; (*b) = 180;
-		break;
-	case lavender: // lavender
-#ifdef SERIAL_VERBOSE
-		Serial.println("lavender");
-#endif
-		(*r) = 230; (*g) = 230; (*b) = 250;
-		break;
-	case plum: // plum
-#ifdef SERIAL_VERBOSE
-		Serial.println("plum");
-#endif
-		(*r) = 221; (*g) = 160; (*b) = 221;
-		break;
-	case lime: // lime
-#ifdef SERIAL_VERBOSE
-		Serial.println("lime");
-#endif
-		(*r) = 50; (*g) = 205; (*b) = 50;
-		break;
-	case orange: // orange
-#ifdef SERIAL_VERBOSE
-		Serial.println("orange");
-#endif
-		(*r) = 255; (*g) = 165; (*b) = 0;
-		break;
-	case powder_blue: // powder blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("powder blue");
-#endif
-		(*r) = 176; (*g) = 244; (*b) = 230;
-		break;
-	case purple: // purple
-#ifdef SERIAL_VERBOSE
-		Serial.println("purple");
-#endif
-		(*r) = 128; (*g) = 0; (*b) = 128;
-		break;
-	case teal: // teal
-#ifdef SERIAL_VERBOSE
-		Serial.println("teal");
-#endif
-		(*r) = 0; (*g) = 128; (*b) = 128;
-		break;
+		char tableCh = pgm_read_byte(tablePos++);
+		char nameCh = *namePos;
+
+		if (nameCh >= 'A' && nameCh <= 'Z')
+			nameCh = nameCh - 'A' + 'a';
+
+		if (nameCh < 'a' || nameCh > 'z')
+		{
+			// reached the end of the name we are looking for
+			if (tableCh == ',' || tableCh == 0)
+				return colourNo;
+		}
+		else
+		{
+			if (nameCh == tableCh)
+			{
+				namePos++;
+				continue;
+			}
+		}
+
+		// mismatch - skip to the start of the next name in the table
+		while (tableCh != ',' && tableCh != 0)
+			tableCh = pgm_read_byte(tablePos++);
+
+		if (tableCh == 0)
+			return -1;
+
+		colourNo++;
+		namePos = name;
 	}
 }
 
+void selectColour(lightColor color, byte *r, byte *g, byte *b)
+{
+	getColourFromTable(color, r, g, b);
+}
+
 void pickRandomColour(byte *r, byte *g, byte *b)
 {
-	switch (random(0, 13))
-	{
-	case 0: // red
-#ifdef SERIAL_VERBOSE
-		Serial.println("Red");
-#endif
-		(*r) = 255; (*g) = 0; (*b) = 0;
-		break;
-	case 1: // blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("Blue");
-#endif
-		(*r) = 0; (*g) = 0; (*b) = 255;
-		break;
-	case 2: // green
-#ifdef SERIAL_VERBOSE
-		Serial.println("Green");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 0;
-		break;
-	case 3: // lilac
-#ifdef SERIAL_VERBOSE
-		Serial.println("Lilac");
-#endif
-		(*r) = 220; (*g) = 208; (*b) = 255;
-		break;
-	case 4: // cyan
-#ifdef SERIAL_VERBOSE
-		Serial.println("cyan");
-#endif
-		(*r) = 0; (*g) = 255; (*b) = 255;
-		break;
-	case 5: // hot pink
-#ifdef SERIAL_VERBOSE
-		Serial.println("hot pink");
-#endif
-		(*r) = 255; (*g) = 105; (*b) = 180;
-		break;
-	case 6: // lavender
-#ifdef SERIAL_VERBOSE
-		Serial.println("lavender");
-#endif
-		(*r) = 230; (*g) = 230; (*b) = 250;
-		break;
-	case 7: // plum
-#ifdef SERIAL_VERBOSE
-		Serial.println("plum");
-#endif
-		(*r) = 221; (*g) = 160; (*b) = 221;
-		break;
-	case 8: // lime
-#ifdef SERIAL_VERBOSE
-		Serial.println("lime");
-#endif
-		(*r) = 50; (*g) = 205; (*b) = 50;
-		break;
-	case 9: // orange
-#ifdef SERIAL_VERBOSE
-		Serial.println("orange");
-#endif
-		(*r) = 255; (*g) = 165; (*b) = 0;
-		break;
-	case 10: // powder blue
-#ifdef SERIAL_VERBOSE
-		Serial.println("powder blue");
-#endif
-		(*r) = 176; (*g) = 244; (*b) = 230;
-		break;
-	case 11: // purple
-#ifdef SERIAL_VERBOSE
-		Serial.println("purple");
-#endif
-		(*r) = 128; (*g) = 0; (*b) = 128;
-		break;
-	case 12: // teal
-#ifdef SERIAL_VERBOSE
-		Serial.println("teal");
-#endif
-		(*r) = 0; (*g) = 128; (*b) = 128;
-		break;
-	}
+	getColourFromTable(randomRange(0, NO_OF_ROBOT_COLOURS), r, g, b);
 }
 
 
-void transitionToColor(byte speed, byte r, byte g, byte b)
+// Fades all the lights to a colour over 50 steps of speed ticks
+
+void transitionToColor(byte speed, byte r, byte g, byte b, byte curve)
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
-		startLightTransition(i, 50, speed, r, g, b);
+	startTransition(50UL * speed * TICK_INTERVAL, curve);
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+		startLightTransition(i, r, g, b);
 }
 
 void transitionToRandomColor()
@@ -1007,35 +2246,43 @@ void transitionToRandomColor()
 
 	pickRandomColour(&r, &g, &b);
 
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
-		startLightTransition(i, 50, 20, r, g, b);
+	startTransition(50UL * 20 * TICK_INTERVAL, curveEaseInOut);
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+		startLightTransition(i, r, g, b);
 }
 
 void flickeringColouredLights(byte r, byte g, byte b, byte min, byte max)
 {
-	if (r == oldr & g == oldg & b == oldb)
+	if (r == oldr & g == oldg & b == oldb & activeSegment == oldFlickerSegment)
 	{
 		return;
 	}
 
-	for (byte i = 0; i < NO_OF_LIGHTS; i++) {
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++) {
 		colouredFlickeringLight(
 			r, g, b,     // colour
-			random(1, max - min),//60,            // flicker brightness
-			random(1, (int)(max - min) / flickerUpdateSpeed),            // flicker update step
+			flickerLevel(i, 1, min, max),            // flicker brightness
+			flickerStep(i, min, max),            // flicker update step
 			min,            // flicker minimum
 			max,           // flicker maximum
 			1,             // number of ticks per flicker update - flicker speed
-			NO_OF_GAPS*i,  // position on the ring
+			lightHomePosition(i),  // position on the ring
 			&lights[i]);   // ligit to make flicker
 	}
 	oldr = r;
 	oldb = b;
 	oldg = g;
+	oldFlickerSegment = activeSegment;
 }
 
 
 
+void steadyColouredLights(byte r, byte g, byte b)
+{
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+		setLightColor(r, g, b, i);
+}
+
 void flickeringColouredLights(lightColor color, byte min, byte max)
 {
 	byte r, g, b;
@@ -1057,8 +2304,9 @@ void do_set_fade_colour(byte * buffer)
 	Serial.print(" no of steps to colour:");
 	Serial.print(buffer[4]);
 #endif 
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
-		startLightTransition(i, buffer[3], buffer[4], buffer[0], buffer[1], buffer[2]);
+	startTransition((unsigned long)buffer[3] * buffer[4] * TICK_INTERVAL, curveLinear);
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+		startLightTransition(i, buffer[0], buffer[1], buffer[2]);
 }
 
 void do_set_brightness(byte * buffer)
@@ -1069,6 +2317,7 @@ void do_set_brightness(byte * buffer)
 #endif
 
 	lightBrightness = buffer[0];
+	setAllSegmentsChanged();
 }
 
 void do_set_flickering_colour(byte * buffer)
@@ -1086,7 +2335,7 @@ void do_set_flickering_colour(byte * buffer)
 
 void do_start_flickering()
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++) {
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++) {
 		flickeringLight(
 			60,            // flicker brightness
 			20,            // flicker update step
@@ -1100,7 +2349,7 @@ void do_start_flickering()
 
 void do_stop_flickering()
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++) {
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++) {
 		steadyLight(
 			lights[i].pos,  // position on the ring
 			&lights[i]);   // ligit to make steady
@@ -1112,85 +2361,337 @@ void do_start_sparkle()
 	randomiseLights();
 }
 
-void updateLights()
+// Sets all the lights moving. 
+// dist is the number of positions moved each time (NO_OF_GAPS positions to a pixel)
+// speed is the number of ticks between moves
+// The lights move between the pixels minPixel and maxPixel. If maxPixel is not 
+// above minPixel they use the whole strip.
+
+void moveLights(byte mode, int8_t dist, byte speed, byte minPixel, byte maxPixel)
 {
-	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+	{
+		lights[i].moveMode = mode;
+		lights[i].moveDist = dist;
+		lights[i].moveSpeed = speed;
+		lights[i].posMin = minPixel * NO_OF_GAPS;
+		lights[i].posMax = maxPixel * NO_OF_GAPS;
+	}
+	setLightsChanged();
+}
+
+// Sets all the lights to the same hue, saturation and value
+// If hueUpdate is not zero the lights cycle round the colour wheel
+
+void hueColouredLights(uint16_t hue, byte saturation, byte value, int8_t hueUpdate, byte colourSpeed)
+{
+	for (byte i = segmentFirstLight(); i < segmentLightLimit(); i++)
+	{
+		hueLight(hue, hueUpdate, saturation, value, colourSpeed, lightHomePosition(i), &lights[i]);
+	}
+}
+
+// Spreads the colour wheel along the lights in the segment. If hueUpdate is not zero 
+// the rainbow chases along the strip
+
+void rainbowLights(byte saturation, byte value, int8_t hueUpdate, byte colourSpeed)
+{
+	byte first = segmentFirstLight();
+	byte noOfLights = segmentLightLimit() - first;
+
+	for (byte i = first; i < segmentLightLimit(); i++)
+	{
+		hueLight((uint16_t)(((long)(i - first) * HUE_RANGE) / noOfLights), hueUpdate, saturation, value, 
+			colourSpeed, lightHomePosition(i), &lights[i]);
+	}
+}
+
+// Returns true if the light will change on a future tick
+
+bool lightIsAnimating(byte i)
+{
+	if (lights[i].lightState == lightStateOff)
+		return false;
+
+	if (lights[i].transitioning)
+		return true;
+
+	if (lights[i].lightState != lightStateHueCycle && lights[i].colourSpeed != 0 && 
+		(lights[i].rUpdate != 0 || lights[i].gUpdate != 0 || lights[i].bUpdate != 0))
+		return true;
+
+	if (lights[i].moveSpeed != 0 && lights[i].moveDist != 0)
+		return true;
+
+	if (lights[i].flickerUpdate != 0 && flickerBlocks[lights[i].flickerBlock].speed != 0)
+		return true;
+
+	if (lights[i].lightState == lightStateHueCycle && lights[i].colourSpeed != 0 &&
+		(lights[i].hueUpdate != 0 || lights[i].saturationUpdate != 0 || lights[i].valueUpdate != 0))
+		return true;
+
+	return false;
+}
+
+// Updates and draws the lights in one segment. The segment is made active 
+// while it is updated, and the effects see the tick count of the segment.
+
+void updateSegment(byte s)
+{
+	struct Segment * seg = &segments[s];
+
+	byte savedSegment = activeSegment;
+	activeSegment = s;
+
+	seg->tickCount++;
+	tickCount = seg->tickCount;
+
+	updateTransitionClock(seg);
+
+	unsigned long stageStart = micros();
+
+	for (byte i = seg->firstLight; i < seg->lightLimit; i++)
 	{
 		updateLightColours(i);
+		updateLightHue(i);
+	}
+
+	stageStart = recordStageTime(lightStageColours, stageStart);
+
+	for (byte i = seg->firstLight; i < seg->lightLimit; i++)
 		updateLightPosition(i);
+
+	stageStart = recordStageTime(lightStagePosition, stageStart);
+
+	seg->animating = false;
+
+	for (byte i = seg->firstLight; i < seg->lightLimit; i++)
+	{
 		updateLightFlicker(i);
+		if (lightIsAnimating(i))
+			seg->animating = true;
 	}
 
-	renderLights();
+	stageStart = recordStageTime(lightStageFlicker, stageStart);
+
+	drawSegment(s);
+
+	recordStageTime(lightStageRender, stageStart);
+
+	seg->changed = false;
+
+	activeSegment = savedSegment;
 }
 
-void updateLightsAndDelay(bool wantDelay)
+// Sends the frame buffer to the strip. The flush is timed with the show, 
+// as it is done once per frame however many segments were drawn.
+
+void showFrame()
 {
-	tickEnd = millis() + TICK_INTERVAL;
+	unsigned long stageStart = micros();
 
-	tickCount++;
+	flushFrameBuffer();
+	showLights();
 
-	updateLights();
+	recordStageTime(lightStageShow, stageStart);
 
-	if (transitionComplete())
-	{
-		if(randomColourTransitions)
-			transitionToRandomColor();
-	}
+#if LIGHT_STAGE_TIMING
+	// the show is recorded for every frame, so this stops with it
+	if (!stageTimingsFull)
+		timedFrames++;
+#endif
+
+	lightsAnimating = frameDithering;
 
-	if (wantDelay)
+	for (byte s = 0; s < noOfSegments; s++)
 	{
-		while (millis() < tickEnd) {
-			delay(1);
-		}
+		if (segments[s].animating)
+			lightsAnimating = true;
 	}
 }
 
-// Pixel position for busy display
+// Light position for busy display
 byte pixelPos = 0;
 byte busyRed, busyGreen, busyBlue;
 
+// segment the busy display runs in
+byte busySegment = 0;
+
+// Moves the busy pixel on. Only the busy segment is marked as changed, so 
+// the next frame does not redraw the rest of the strip.
+
 void updateBusyPixel()
 {
+	byte savedSegment = activeSegment;
+	activeSegment = busySegment;
 
 	// turn off the current pixel dot
 	setLightColor(0, 0, 0, pixelPos);
 
 	pixelPos++;
 
-	if (pixelPos == PIXELS)
-		pixelPos = 0;
+	if (pixelPos >= segmentLightLimit())
+		pixelPos = segmentFirstLight();
 
 	setLightColor(busyRed, busyGreen, busyBlue, pixelPos);
 
-	updateLights();
+	activeSegment = savedSegment;
 }
 
+// Number of busy pixel steps left in a timed display started by 
+// displayBusyPixelWait. Zero when no timed display is running.
+int busyPixelStepsLeft = 0;
+unsigned long lastBusyPixelStepTime;
+
+#define BUSY_PIXEL_STEP_INTERVAL 200
+
 void startBusyPixel(byte red, byte green, byte blue)
 {
+	busyPixelStepsLeft = 0;
 	busyRed = red;
 	busyBlue = blue;
 	busyGreen = green;
+	busySegment = activeSegment;
 	setAllLightsOff();
-	pixelPos = 0;
+	pixelPos = segmentFirstLight();
 	updateBusyPixel();
 }
 
 void stopBusyPixel()
 {
+	byte savedSegment = activeSegment;
+	activeSegment = busySegment;
 	setAllLightsOff();
+	activeSegment = savedSegment;
 	oldr = 0;
 	oldg = 0; 
 	oldb = 0;
 }
 
+// Shows the busy pixel moving round the lights for the given number of 
+// steps. This returns straight away and the display is advanced by 
+// updateLightsAndDelay, so the robot can accept commands and run its 
+// stored program while the display is showing. 
+
 void displayBusyPixelWait(int ticks, byte red, byte green, byte blue)
 {
 	startBusyPixel(red, green, blue);
-	for (int i = 0; i < ticks; i++)
-	{
+	busyPixelStepsLeft = ticks;
+	lastBusyPixelStepTime = millis();
+}
+
+// Ends a timed busy pixel display early. Called before any pixel command 
+// so that the display does not overwrite the new light settings. 
+
+void cancelBusyPixelWait()
+{
+	if (busyPixelStepsLeft == 0)
+		return;
+
+	busyPixelStepsLeft = 0;
+	stopBusyPixel();
+}
+
+void updateBusyPixelWait(unsigned long now)
+{
+	if (busyPixelStepsLeft == 0)
+		return;
+
+	if (now - lastBusyPixelStepTime < BUSY_PIXEL_STEP_INTERVAL)
+		return;
+
+	lastBusyPixelStepTime = now;
+
+	busyPixelStepsLeft--;
+
+	if (busyPixelStepsLeft == 0)
+		stopBusyPixel();
+	else
 		updateBusyPixel();
-		delay(200);
+}
+
+// Returns true if the segment should be updated. Changed segments are 
+// drawn straight away. Animating segments are drawn at their own tick 
+// interval, and static ones every IDLE_REFRESH_INTERVAL. 
+
+bool segmentDue(byte s, unsigned long now)
+{
+	struct Segment * seg = &segments[s];
+
+	if (seg->changed)
+		return true;
+
+	uint16_t timeSinceLastTick = (uint16_t)now - seg->lastTickTime;
+
+	if (seg->animating)
+		return timeSinceLastTick >= seg->tickInterval;
+
+	return IDLE_REFRESH_INTERVAL != 0 && timeSinceLastTick >= IDLE_REFRESH_INTERVAL;
+}
+
+// Draws the segments that are due and shows the frame if any of them were 
+// drawn. Segments that are not due keep the pixels they drew last time. 
+// While the last frame has dither fractions to carry the frame is flushed 
+// again every TICK_INTERVAL, even if no segment was drawn, until the 
+// dithering settles. 
+// This never waits for the next frame, so the spare time goes back to 
+// program execution and the serial port. 
+// If wantDelay is false every segment is drawn on every call.
+
+void updateLightsAndDelay(bool wantDelay)
+{
+	unsigned long now = millis();
+
+	updateBusyPixelWait(now);
+
+	if (powerBudgetChanged())
+		markAllSegmentsChanged();
+
+	if (rawFrameMode)
+		return;
+
+	bool frameDue = false;
+	bool lightsChanged = false;
+
+	for (byte s = 0; s < noOfSegments; s++)
+	{
+		if (wantDelay && !segmentDue(s, now))
+			continue;
+
+		// an idle refresh draws the same frame again
+		if (segments[s].changed || segments[s].animating)
+			lightsChanged = true;
+
+		frameDue = true;
+		segments[s].lastTickTime = now;
+		updateSegment(s);
 	}
-	stopBusyPixel();
+
+	if (!frameDue && frameDithering && now - lastTickTime >= TICK_INTERVAL)
+		frameDue = true;
+
+	if (!frameDue)
+		return;
+
+	lastTickTime = now;
+
+#if LIGHT_DITHERING
+	if (lightsChanged)
+		ditherFramesSinceChange = 0;
+	else if (ditherFramesSinceChange < DITHER_SETTLE_FRAMES)
+		ditherFramesSinceChange++;
+#endif
+
+	showFrame();
+
+	byte savedSegment = activeSegment;
+
+	for (byte s = 0; s < noOfSegments; s++)
+	{
+		activeSegment = s;
+		if (segments[s].randomTransitions && transitionComplete())
+			transitionToRandomColor();
+	}
+
+	activeSegment = savedSegment;
 }
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////
+/// Random Numbers
+///////////////////////////////////////////////////////////
+
+// A 16 bit xorshift generator shared by the lights and the program
+// control commands. It is much faster than the library random() on the
+// AVR, which works in 32 bit arithmetic and divides on every call, and
+// it can be seeded from the command protocol so that runs can be repeated.
+// The state must never be zero, as the generator would then stay there.
+
+#define RANDOM_DEFAULT_SEED 0xACE1
+
+uint16_t randomState = RANDOM_DEFAULT_SEED;
+
+//#define RANDOM_DEBUG
+
+void seedRandom(uint16_t seed)
+{
+#ifdef RANDOM_DEBUG
+	Serial.print(F(".Random seed: "));
+	Serial.println(seed);
+#endif
+
+	if (seed == 0)
+		seed = RANDOM_DEFAULT_SEED;
+
+	randomState = seed;
+}
+
+uint16_t random16()
+{
+	// xorshift with shifts of 7, 9 and 8 gives a full period of 65535
+	randomState ^= randomState << 7;
+	randomState ^= randomState >> 9;
+	randomState ^= randomState << 8;
+	return randomState;
+}
+
+byte random8()
+{
+	// the top bits of the state are the most random
+	return (byte)(random16() >> 8);
+}
+
+// Returns a value from 0 up to but not including limit, with every value
+// equally likely. The random value is scaled by a multiply rather than
+// reduced with a modulus, and the few results that would favour some
+// values are thrown away. The division that finds them is only done when
+// a result lands in the region where that can happen.
+
+uint16_t randomBelow(uint16_t limit)
+{
+	if (limit == 0)
+		return 0;
+
+	uint32_t product = (uint32_t)random16() * limit;
+	uint16_t fraction = (uint16_t)product;
+
+	if (fraction < limit)
+	{
+		uint16_t threshold = (uint16_t)(0 - limit) % limit;
+		while (fraction < threshold)
+		{
+			product = (uint32_t)random16() * limit;
+			fraction = (uint16_t)product;
+		}
+	}
+
+	return (uint16_t)(product >> 16);
+}
+
+// Same as randomBelow but for limits up to 256, which only needs an 8 bit
+// by 8 bit multiply. Used by the lights, where most ranges are bytes.
+
+byte random8Below(uint16_t limit)
+{
+	if (limit > 256)
+		return (byte)randomBelow(limit);
+
+	if (limit == 0)
+		return 0;
+
+	uint16_t product = (uint16_t)random8() * limit;
+	byte fraction = (byte)product;
+
+	if (fraction < limit)
+	{
+		byte threshold = (byte)((256 - limit) % limit);
+		while (fraction < threshold)
+		{
+			product = (uint16_t)random8() * limit;
+			fraction = (byte)product;
+		}
+	}
+
+	return (byte)(product >> 8);
+}
+
+// Replacement for random(min, max). Returns a value from min up to but not
+// including max, or min if the range is empty.
+
+int randomRange(int min, int max)
+{
+	if (max <= min)
+		return min;
+
+	uint16_t span = (uint16_t)(max - min);
+
+	if (span <= 256)
+		return min + random8Below(span);
+
+	return min + (int)randomBelow(span);
+}
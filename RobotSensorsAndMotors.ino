@@ -34,17 +34,21 @@
 
 #include "Storage.h"
 
+#include "RandomNumbers.h"
+
 #include "PixelControl.h"
 
 #include "MotorControl.h"
 
 #include "DistanceSensor.h"
 
+#include "LightModes.h"
+
 #include "Commands.h"
 
 void setup() {
 	Serial.begin(1200);
-	Serial.println(version);
+	Serial.println(F(VERSION_TEXT));
 
 	// Uncomment to test the distance sensor
 	// Repeatedly sends readings
@@ -55,6 +59,7 @@ void setup() {
 	setupDistanceSensor(25);
 	setupRemoteControl();
 	startLights();
+	// The startup display runs in the background while commands are accepted
 	displayBusyPixelWait(6, 0, 255, 255);
 	startProgramExecution(STORED_PROGRAM_OFFSET);
 }
@@ -63,5 +68,6 @@ void setup() {
 void loop() {
 	updateProgramExcecution();
 	updateDistanceSensor();
+	updateLightModes();
 	updateLightsAndDelay(!commandsNeedFullSpeed());
 }
@@ -2,8 +2,12 @@
 #define STORED_PROGRAM_OFFSET 20
 
 #define PROGRAM_STATUS_BYTE_OFFSET 0
+
+// The second value marks the format of the compiled program. Change it
+// whenever the bytecode or the command table changes, so that a program
+// stored by an older build is not run.
 #define PROGRAM_STORED_VALUE1 0xaa
-#define PROGRAM_STORED_VALUE2 0x55
+#define PROGRAM_STORED_VALUE2 0x57
 
 #define WHEEL_SETTINGS_OFFSET 2
 
@@ -0,0 +1,139 @@
+#include "HostHarness.h"
+
+#include <stdlib.h>
+
+#ifndef GOLDEN_DIR
+#define GOLDEN_DIR "golden"
+#endif
+
+// provided by the firmware built into each program
+void setup();
+void loop();
+
+int hostFailures = 0;
+
+void hostStartFirmware()
+{
+	setup();
+	hostSerialOutput.clear();
+}
+
+void hostCommand(const char * command)
+{
+	hostSerialSend(std::string(command) + '\r');
+}
+
+void hostRun(unsigned long ms)
+{
+	for (unsigned long i = 0; i < ms; i++)
+	{
+		loop();
+		hostAdvanceMillis(1);
+	}
+}
+
+static bool readFile(const std::string & path, std::string * text)
+{
+	FILE * file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return false;
+
+	char buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		text->append(buffer, n);
+
+	fclose(file);
+	return true;
+}
+
+static bool writeFile(const std::string & path, const std::string & text)
+{
+	FILE * file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	fwrite(text.data(), 1, text.size(), file);
+	return fclose(file) == 0;
+}
+
+bool hostCheckGolden(const char * name, const std::string & text)
+{
+	std::string path = std::string(GOLDEN_DIR) + "/" + name + ".txt";
+
+	if (getenv("UPDATE_GOLDEN") != NULL)
+	{
+		if (writeFile(path, text))
+			return true;
+		printf("Cannot write golden file %s\n", path.c_str());
+		hostFailures++;
+		return false;
+	}
+
+	std::string golden;
+
+	if (!readFile(path, &golden))
+	{
+		printf("Missing golden file %s, run with UPDATE_GOLDEN=1 to create it\n", path.c_str());
+		hostFailures++;
+		return false;
+	}
+
+	if (golden == text)
+		return true;
+
+	std::string actualPath = std::string(name) + ".actual";
+	writeFile(actualPath, text);
+
+	size_t start = 0;
+	int line = 1;
+
+	while (start < golden.size() && start < text.size())
+	{
+		size_t goldenEnd = golden.find('\n', start);
+		size_t textEnd = text.find('\n', start);
+
+		if (goldenEnd != textEnd || golden.compare(start, goldenEnd - start, text, start, textEnd - start) != 0)
+			break;
+
+		start = goldenEnd + 1;
+		line++;
+	}
+
+	printf("%s differs from %s at line %d, output written to %s\n", name, path.c_str(), line, actualPath.c_str());
+	hostFailures++;
+	return false;
+}
+
+bool hostCheck(bool condition, const char * text, const char * file, int line)
+{
+	if (!condition)
+	{
+		printf("%s:%d: check failed: %s\n", file, line, text);
+		hostFailures++;
+	}
+	return condition;
+}
+
+bool hostCheckEqual(long expected, long actual, const char * text, const char * file, int line)
+{
+	if (expected != actual)
+	{
+		printf("%s:%d: %s is %ld, expected %ld\n", file, line, text, actual, expected);
+		hostFailures++;
+		return false;
+	}
+	return true;
+}
+
+int hostTestResult(const char * testName)
+{
+	if (hostFailures == 0)
+	{
+		printf("%s: passed\n", testName);
+		return 0;
+	}
+
+	printf("%s: %d failures\n", testName, hostFailures);
+	return 1;
+}
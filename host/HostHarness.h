@@ -0,0 +1,44 @@
+// Runs the firmware on the PC for the tests, benchmarks and the pixel 
+// simulator. Each program includes RobotSensorsAndMotors.ino after this 
+// header, so the whole firmware is built into it as one unit, just as the 
+// Arduino IDE builds it.
+
+#ifndef HOST_HARNESS_H
+#define HOST_HARNESS_H
+
+#include "HostShim.h"
+
+#include <stdio.h>
+#include <string>
+
+// Runs setup() and clears anything it printed
+void hostStartFirmware();
+
+// Sends a command to the serial port, adding the statement terminator
+void hostCommand(const char * command);
+
+// Calls loop() once for every millisecond of the time given, moving the 
+// clock on after each call
+void hostRun(unsigned long ms);
+
+// Compares the text with the golden file of the given name. If the 
+// UPDATE_GOLDEN environment variable is set the golden file is written 
+// instead. On a mismatch the text is written to name.actual in the 
+// working directory and the first different line is reported.
+bool hostCheckGolden(const char * name, const std::string & text);
+
+extern int hostFailures;
+
+#define HOST_CHECK(condition) \
+	hostCheck((condition), #condition, __FILE__, __LINE__)
+
+#define HOST_CHECK_EQUAL(expected, actual) \
+	hostCheckEqual((long)(expected), (long)(actual), #actual, __FILE__, __LINE__)
+
+bool hostCheck(bool condition, const char * text, const char * file, int line);
+bool hostCheckEqual(long expected, long actual, const char * text, const char * file, int line);
+
+// Prints the result and returns the exit code for the test program
+int hostTestResult(const char * testName);
+
+#endif
@@ -0,0 +1,69 @@
+// Measures how long the command interpreter takes to decode and run a mix
+// of remote commands, and how long a command table lookup takes. The
+// commands go straight to processCommand so that the figures are for the
+// decoder and not for the serial port. The lookup is only timed when the
+// firmware has a command table.
+//
+// CommandBenchmark [runs]
+
+#include <chrono>
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+const char * commandMix[] = {
+	"PA0", "PG1", "PH120,255,128,1", "PM0,1,2,0,0", "PW3,200", "PI1,10,20,30", "CS1234", "PM0,0,0"
+};
+
+#define NO_OF_MIX_COMMANDS (sizeof(commandMix) / sizeof(const char *))
+
+volatile long commandSink = 0;
+
+int main(int argc, char ** argv)
+{
+	long runs = argc > 1 ? atol(argv[1]) : 100000;
+
+	hostStartFirmware();
+
+	diagnosticsOutputLevel = 0;
+
+	printf("Command benchmark, %u commands, %ld runs\n", (unsigned)NO_OF_MIX_COMMANDS, runs);
+
+	char buffer[COMMAND_BUFFER_SIZE];
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (long run = 0; run < runs; run++)
+	{
+		for (size_t c = 0; c < NO_OF_MIX_COMMANDS; c++)
+		{
+			size_t length = strlen(commandMix[c]);
+			memcpy(buffer, commandMix[c], length);
+			buffer[length] = STATEMENT_TERMINATOR;
+			processCommand(buffer, buffer + length + 1);
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	long commands = runs * (long)NO_OF_MIX_COMMANDS;
+
+	printf("%-16s %10.0f commands/s %8.1f ns/command\n", "decode and run", commands / seconds, seconds * 1e9 / commands);
+
+#ifdef NO_OF_COMMANDS
+	start = std::chrono::steady_clock::now();
+
+	for (long run = 0; run < runs; run++)
+	{
+		for (byte i = 0; i < NO_OF_COMMANDS; i++)
+			commandSink += findCommand(pgm_read_byte(&commandTable[i].group), pgm_read_byte(&commandTable[i].command));
+	}
+
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	long lookups = runs * (long)NO_OF_COMMANDS;
+
+	printf("%-16s %10.0f lookups/s  %8.1f ns/lookup\n", "table lookup", lookups / seconds, seconds * 1e9 / lookups);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+// Measures how many light ticks a second the PC can run through 
+// updateLightsAndDelay, with every segment drawn on every tick. The 
+// figures are for comparing changes to the light engine, not a measure of 
+// the robot, which is many times slower.
+//
+// LightBenchmark [ticks]
+
+#include <chrono>
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+struct LightScene
+{
+	const char * name;
+	const char * commands[4];
+};
+
+const LightScene lightScenes[] = {
+	{ "steady", { "PNblue" } },
+	{ "candle", { "PC255,128,0" } },
+	{ "sparkle", { "PR" } },
+	{ "rainbow", { "PW8" } },
+	{ "fade", { "PX1,blue,3" } },
+	{ "dim", { "PH0,255,20,4" } }
+};
+
+#define NO_OF_LIGHT_SCENES (sizeof(lightScenes) / sizeof(struct LightScene))
+
+int main(int argc, char ** argv)
+{
+	long ticks = argc > 1 ? atol(argv[1]) : 20000;
+
+	hostStartFirmware();
+
+	printf("Light benchmark, %d pixels, %d lights, %ld ticks per scene\n", PIXELS, NO_OF_LIGHTS, ticks);
+
+	for (size_t s = 0; s < NO_OF_LIGHT_SCENES; s++)
+	{
+		for (byte i = 0; i < 4 && lightScenes[s].commands[i] != NULL; i++)
+			hostCommand(lightScenes[s].commands[i]);
+
+		// let the commands through and any busy display finish
+		hostRun(TICK_INTERVAL);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		for (long t = 0; t < ticks; t++)
+		{
+			updateLightsAndDelay(false);
+			hostAdvanceMillis(TICK_INTERVAL);
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		printf("%-8s %10.0f ticks/s %8.3f us/tick\n", lightScenes[s].name, ticks / seconds, seconds * 1e6 / ticks);
+	}
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+// Measures how fast stored program statements run, reading the program
+// straight from the EEPROM, through a window that holds the loop but not
+// the whole program, and with the whole program in the cache. The EEPROM
+// reads for each statement are counted as well, as they are what costs
+// the time on the robot. The test program only changes light settings and
+// jumps, and is downloaded into the EEPROM of the PC, so nothing on the
+// robot is touched. The cache is left out of the firmware by default, so 
+// the benchmark is built with one.
+//
+// ProgramBenchmark [statements]
+
+#include <chrono>
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+const char * const testProgram[] = {
+	"#benchmark program", "PA0", "PM0,1,2,0,0", "PW3,200", "CLtop", "PC255,0,0", "PH120,255,128,1", "CTtop", "CJtop", NULL
+};
+
+#define BENCHMARK_PROGRAM_WINDOW 64
+
+void timeStatements(const char * name, long statements)
+{
+	programCounter = STORED_PROGRAM_OFFSET;
+	programState = PROGRAM_ACTIVE;
+	seedRandom(RANDOM_DEFAULT_SEED);
+	hostEepromReads = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (long i = 0; i < statements; i++)
+		exeuteProgramStatement();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	programState = PROGRAM_STOPPED;
+
+	printf("%-8s %10.0f statements/s %8.1f ns/statement %6.2f EEPROM reads/statement\n",
+		name, statements / seconds, seconds * 1e9 / statements, (double)hostEepromReads / statements);
+}
+
+int main(int argc, char ** argv)
+{
+	long statements = argc > 1 ? atol(argv[1]) : 1000000;
+
+	hostStartFirmware();
+
+	hostCommand("RM");
+
+	for (byte i = 0; testProgram[i] != NULL; i++)
+		hostCommand(testProgram[i]);
+
+	hostCommand("RX");
+	hostRun(1);
+	haltProgramExecution();
+
+	printf("Program benchmark, %d program bytes, %ld statements\n", programWriteBase - STORED_PROGRAM_OFFSET, statements);
+
+#if PROGRAM_CACHE_SIZE > 0
+	setProgramCacheLimit(0);
+	timeStatements("eeprom", statements);
+	setProgramCacheLimit(BENCHMARK_PROGRAM_WINDOW);
+	timeStatements("window", statements);
+	setProgramCacheLimit(PROGRAM_CACHE_SIZE);
+	timeStatements("cache", statements);
+#else
+	timeStatements("eeprom", statements);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+// Compares the time taken by the library random() with the xorshift 
+// generator for the kinds of call the lights and coin toss make. The 
+// library random() in the host shim is the avr-libc algorithm, so the 
+// comparison is like for like, although the PC does not show the cost of 
+// the 32 bit division that makes random() so slow on the AVR.
+//
+// RandomBenchmark [calls]
+
+#include <chrono>
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+volatile long randomSink = 0;
+
+long libraryByte() { return random(0, 256); }
+long libraryToss() { return random(0, 2); }
+long fastByte() { return randomRange(0, 256); }
+long fastToss() { return randomRange(0, 2); }
+long fastWide() { return randomRange(0, 384); }
+
+void timeCalls(const char * name, long(*call)(), long calls)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (long i = 0; i < calls; i++)
+		randomSink += call();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%-20s %8.2f ns/call\n", name, seconds * 1e9 / calls);
+}
+
+int main(int argc, char ** argv)
+{
+	long calls = argc > 1 ? atol(argv[1]) : 10000000;
+
+	printf("Random benchmark, %ld calls\n", calls);
+
+	timeCalls("random(0,256)", libraryByte, calls);
+	timeCalls("random(0,2)", libraryToss, calls);
+	timeCalls("randomRange(0,256)", fastByte, calls);
+	timeCalls("randomRange(0,2)", fastToss, calls);
+	timeCalls("randomRange(0,384)", fastWide, calls);
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+// Host replacement for the Adafruit NeoPixel library. Every call of show()
+// records the pixels, so the frames the firmware sends can be compared 
+// with known good ones or written out as images. See HostShim.h.
+
+#ifndef HOST_ADAFRUIT_NEOPIXEL_H
+#define HOST_ADAFRUIT_NEOPIXEL_H
+
+#include "Arduino.h"
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+
+class Adafruit_NeoPixel
+{
+public:
+	Adafruit_NeoPixel(uint16_t n, uint8_t pin, uint8_t type);
+	~Adafruit_NeoPixel();
+
+	void begin() {}
+	void show();
+	void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b);
+	void setPixelColor(uint16_t n, uint32_t c);
+	uint32_t getPixelColor(uint16_t n) const;
+	uint16_t numPixels() const { return numLEDs; }
+	uint8_t * getPixels() const { return pixels; }
+
+private:
+	uint16_t numLEDs;
+	uint8_t * pixels;
+};
+
+#endif
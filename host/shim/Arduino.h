@@ -0,0 +1,158 @@
+// Host replacement for the parts of the Arduino core used by the firmware.
+// The firmware is compiled for the PC so that the light engine and the
+// command interpreter can be tested and timed without a robot.
+// Differences from the AVR that matter when reading results:
+//   int is 32 bits on the PC, 16 bits on the AVR
+//   program memory is ordinary memory, so the pgm_read functions just read it
+//   the clock only moves when the harness moves it (see HostShim.cpp)
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define CHANGE 1
+
+#define DEC 10
+#define HEX 16
+
+#define PI 3.1415926535897932384626433832795
+
+// binary constants used by the motor waveforms
+#define B00001 1
+#define B00010 2
+#define B00011 3
+#define B00100 4
+#define B00110 6
+#define B01000 8
+#define B01001 9
+#define B01100 12
+#define B00010000 16
+#define B00100000 32
+#define B00110000 48
+#define B01000000 64
+#define B01100000 96
+#define B10000000 128
+#define B10010000 144
+#define B11000000 192
+
+#define abs(x) ((x)>0?(x):-(x))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+/////////////////////////////////////////////
+//  Program memory
+/////////////////////////////////////////////
+
+#define PROGMEM
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PSTR(s) (s)
+
+inline uint8_t pgm_read_byte(const void * p) { return *(const uint8_t *)p; }
+inline uint8_t pgm_read_byte_near(const void * p) { return *(const uint8_t *)p; }
+
+// On the AVR a word is 16 bits, which also holds a function pointer. On the
+// PC the value is returned with its own type so that pointers survive.
+template <class T> inline T pgm_read_word(const T * p) { return *p; }
+
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+/////////////////////////////////////////////
+//  Time, pins and interrupts
+/////////////////////////////////////////////
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+unsigned long pulseIn(uint8_t pin, uint8_t state);
+
+int digitalPinToInterrupt(int pin);
+void attachInterrupt(int interrupt, void(*handler)(), int mode);
+inline void interrupts() {}
+inline void noInterrupts() {}
+
+extern volatile uint8_t PORTB, PORTD, DDRB, DDRD, PINB, PIND;
+
+// Library random number generator, the same algorithm as avr-libc so that
+// it can be compared with the xorshift generator in RandomNumbers.h
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+/////////////////////////////////////////////
+//  Serial port
+/////////////////////////////////////////////
+
+class String
+{
+public:
+	String(const char * s = "") : text(s) {}
+	const char * c_str() const { return text.c_str(); }
+	unsigned int length() const { return (unsigned int)text.size(); }
+private:
+	std::string text;
+};
+
+// Everything printed goes into the host serial output, see HostShim.h
+
+class HostSerial
+{
+public:
+	void begin(long baud) {}
+	int available();
+	int read();
+	size_t write(uint8_t b);
+
+	size_t print(const __FlashStringHelper * s) { return print((const char *)s); }
+	size_t print(const String & s) { return print(s.c_str()); }
+	size_t print(const char * s);
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char b, int base = DEC) { return print((unsigned long)b, base); }
+	size_t print(int n, int base = DEC) { return print((long)n, base); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println() { return print("\r\n"); }
+
+	template <class T> size_t println(T value)
+	{
+		size_t n = print(value);
+		return n + println();
+	}
+
+	template <class T> size_t println(T value, int format)
+	{
+		size_t n = print(value, format);
+		return n + println();
+	}
+};
+
+extern HostSerial Serial;
+
+#endif
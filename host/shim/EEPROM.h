@@ -0,0 +1,22 @@
+// Host replacement for the Arduino EEPROM library. The contents are held in
+// memory and start out erased, as on a new chip.
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE 1024
+
+class EEPROMClass
+{
+public:
+	uint8_t read(int address);
+	void write(int address, uint8_t value);
+	void update(int address, uint8_t value);
+	uint16_t length() { return HOST_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,369 @@
+// Host replacements for the Arduino core, EEPROM, TimerOne and NeoPixel 
+// libraries. See HostShim.h for the controls used by the harness.
+
+#include "HostShim.h"
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "TimerOne.h"
+#include "Adafruit_NeoPixel.h"
+
+/////////////////////////////////////////////
+//  Clock
+/////////////////////////////////////////////
+
+static unsigned long hostMicros = 0;
+static unsigned long hostMicrosCreep = 0;
+
+void hostAdvanceMicros(unsigned long us)
+{
+	hostMicros += us;
+	hostMicrosCreep = 0;
+}
+
+void hostAdvanceMillis(unsigned long ms)
+{
+	hostAdvanceMicros(ms * 1000UL);
+}
+
+unsigned long millis()
+{
+	return hostMicros / 1000UL;
+}
+
+unsigned long micros()
+{
+	return hostMicros + ++hostMicrosCreep;
+}
+
+void delay(unsigned long ms)
+{
+	hostAdvanceMillis(ms);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	hostAdvanceMicros(us);
+}
+
+/////////////////////////////////////////////
+//  Pins and interrupts
+/////////////////////////////////////////////
+
+volatile uint8_t PORTB, PORTD, DDRB, DDRD, PINB, PIND;
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+int digitalRead(uint8_t pin) { return LOW; }
+int analogRead(uint8_t pin) { return 0; }
+unsigned long pulseIn(uint8_t pin, uint8_t state) { return 0; }
+int digitalPinToInterrupt(int pin) { return pin - 2; }
+
+// Pins 2 and 3 have the external interrupts, as on the Uno
+
+static void (*hostInterruptHandlers[2])() = { NULL, NULL };
+
+void attachInterrupt(int interrupt, void(*handler)(), int mode)
+{
+	if (interrupt >= 0 && interrupt < 2)
+		hostInterruptHandlers[interrupt] = handler;
+}
+
+void hostEchoPulse(uint8_t pin, unsigned long pulseMicros)
+{
+	int interrupt = digitalPinToInterrupt(pin);
+
+	if (interrupt < 0 || interrupt >= 2 || hostInterruptHandlers[interrupt] == NULL)
+		return;
+
+	PIND |= (1 << pin);
+	hostInterruptHandlers[interrupt]();
+
+	hostAdvanceMicros(pulseMicros);
+
+	PIND &= ~(1 << pin);
+	hostInterruptHandlers[interrupt]();
+}
+
+TimerOne Timer1;
+
+/////////////////////////////////////////////
+//  Library random numbers
+/////////////////////////////////////////////
+
+// The minimal standard generator used by avr-libc random()
+
+static unsigned long hostRandomState = 1;
+
+long random(long howBig)
+{
+	if (howBig == 0)
+		return 0;
+
+	long x = (long)hostRandomState;
+	if (x == 0)
+		x = 123459876L;
+	long hi = x / 127773L;
+	long lo = x % 127773L;
+	x = 16807L * lo - 2836L * hi;
+	if (x < 0)
+		x += 0x7fffffffL;
+	hostRandomState = (unsigned long)x;
+
+	return x % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+	if (howSmall >= howBig)
+		return howSmall;
+	return random(howBig - howSmall) + howSmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+	if (seed != 0)
+		hostRandomState = seed;
+}
+
+/////////////////////////////////////////////
+//  Serial port
+/////////////////////////////////////////////
+
+HostSerial Serial;
+
+std::string hostSerialOutput;
+bool hostSerialEcho = false;
+
+static std::string hostSerialInput;
+static size_t hostSerialInputPos = 0;
+
+void hostSerialSend(const std::string & text)
+{
+	hostSerialInput.erase(0, hostSerialInputPos);
+	hostSerialInputPos = 0;
+	hostSerialInput += text;
+}
+
+size_t hostSerialPending()
+{
+	return hostSerialInput.size() - hostSerialInputPos;
+}
+
+int HostSerial::available()
+{
+	return (int)hostSerialPending();
+}
+
+int HostSerial::read()
+{
+	if (hostSerialInputPos == hostSerialInput.size())
+		return -1;
+	return (uint8_t)hostSerialInput[hostSerialInputPos++];
+}
+
+size_t HostSerial::write(uint8_t b)
+{
+	hostSerialOutput += (char)b;
+	if (hostSerialEcho)
+		putchar(b);
+	return 1;
+}
+
+size_t HostSerial::print(const char * s)
+{
+	size_t n = 0;
+	while (*s)
+		n += write((uint8_t)*s++);
+	return n;
+}
+
+size_t HostSerial::print(long n, int base)
+{
+	if (base != DEC)
+		return print((unsigned long)(uint32_t)n, base);
+
+	char text[24];
+	snprintf(text, sizeof(text), "%ld", n);
+	return print(text);
+}
+
+size_t HostSerial::print(unsigned long n, int base)
+{
+	char text[40];
+	char * pos = text + sizeof(text) - 1;
+	*pos = 0;
+
+	if (base < 2)
+		base = DEC;
+
+	do
+	{
+		byte digit = n % base;
+		*--pos = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		n /= base;
+	} while (n != 0);
+
+	return print(pos);
+}
+
+size_t HostSerial::print(double n, int digits)
+{
+	char text[48];
+	snprintf(text, sizeof(text), "%.*f", digits, n);
+	return print(text);
+}
+
+/////////////////////////////////////////////
+//  EEPROM
+/////////////////////////////////////////////
+
+uint8_t hostEeprom[HOST_EEPROM_SIZE];
+unsigned long hostEepromReads = 0;
+unsigned long hostEepromWrites = 0;
+
+EEPROMClass EEPROM;
+
+// starts out erased
+static struct HostEepromEraser
+{
+	HostEepromEraser() { memset(hostEeprom, 0xFF, sizeof(hostEeprom)); }
+} hostEepromEraser;
+
+uint8_t EEPROMClass::read(int address)
+{
+	hostEepromReads++;
+	if (address < 0 || address >= HOST_EEPROM_SIZE)
+		return 0xFF;
+	return hostEeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+	hostEepromWrites++;
+	if (address >= 0 && address < HOST_EEPROM_SIZE)
+		hostEeprom[address] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+	if (read(address) != value)
+		write(address, value);
+}
+
+/////////////////////////////////////////////
+//  NeoPixels
+/////////////////////////////////////////////
+
+std::vector<HostFrame> hostFrames;
+bool hostCaptureFrames = false;
+unsigned long hostShowCount = 0;
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, uint8_t pin, uint8_t type)
+{
+	numLEDs = n;
+	pixels = new uint8_t[n * 3];
+	memset(pixels, 0, n * 3);
+}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel()
+{
+	delete[] pixels;
+}
+
+void Adafruit_NeoPixel::show()
+{
+	hostShowCount++;
+
+	if (!hostCaptureFrames)
+		return;
+
+	HostFrame frame;
+	frame.millis = millis();
+	frame.pixels.assign(pixels, pixels + numLEDs * 3);
+	hostFrames.push_back(frame);
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+{
+	if (n >= numLEDs)
+		return;
+	pixels[n * 3] = r;
+	pixels[n * 3 + 1] = g;
+	pixels[n * 3 + 2] = b;
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c)
+{
+	setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c);
+}
+
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const
+{
+	if (n >= numLEDs)
+		return 0;
+	return ((uint32_t)pixels[n * 3] << 16) | ((uint32_t)pixels[n * 3 + 1] << 8) | pixels[n * 3 + 2];
+}
+
+/////////////////////////////////////////////
+//  Frame output
+/////////////////////////////////////////////
+
+std::string hostFrameText(const HostFrame & frame)
+{
+	char text[16];
+	snprintf(text, sizeof(text), "%6lu", frame.millis);
+	std::string line = text;
+
+	for (size_t i = 0; i + 2 < frame.pixels.size(); i += 3)
+	{
+		snprintf(text, sizeof(text), " %02X%02X%02X", frame.pixels[i], frame.pixels[i + 1], frame.pixels[i + 2]);
+		line += text;
+	}
+
+	return line;
+}
+
+std::string hostFramesText(const std::vector<HostFrame> & frames)
+{
+	std::string text;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		text += hostFrameText(frames[i]);
+		text += '\n';
+	}
+	return text;
+}
+
+bool hostWriteFramesPpm(const char * path, const std::vector<HostFrame> & frames, int scale)
+{
+	if (frames.empty())
+		return false;
+
+	if (scale < 1)
+		scale = 1;
+
+	FILE * file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	size_t width = frames[0].pixels.size() / 3;
+
+	fprintf(file, "P6\n%d %d\n255\n", (int)(width * scale), (int)(frames.size() * scale));
+
+	for (size_t f = 0; f < frames.size(); f++)
+	{
+		for (int row = 0; row < scale; row++)
+		{
+			for (size_t p = 0; p < width; p++)
+			{
+				for (int column = 0; column < scale; column++)
+					fwrite(&frames[f].pixels[p * 3], 1, 3, file);
+			}
+		}
+	}
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,61 @@
+// Controls for the host replacements of the Arduino core and libraries.
+// Include this before the firmware, as Arduino.h defines min and max as 
+// macros which upset the standard library headers.
+
+#ifndef HOST_SHIM_H
+#define HOST_SHIM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// The clock only moves when the harness advances it. micros() also creeps
+// on by a microsecond on each call, so loops that wait on it still end, 
+// but this creep is not seen by millis(), so frame timings do not depend 
+// on how many times the firmware reads the clock.
+void hostAdvanceMillis(unsigned long ms);
+void hostAdvanceMicros(unsigned long us);
+
+// Raises the pin for the length of the pulse and then lowers it, calling 
+// the handler attached to its interrupt at each edge, as the echo from the 
+// distance sensor does. The clock moves on by the length of the pulse. 
+// Nothing happens if no handler is attached.
+void hostEchoPulse(uint8_t pin, unsigned long pulseMicros);
+
+// Bytes waiting to be read from the serial port
+void hostSerialSend(const std::string & text);
+size_t hostSerialPending();
+
+// Everything the firmware has printed. Set hostSerialEcho to copy it to 
+// stdout as well.
+extern std::string hostSerialOutput;
+extern bool hostSerialEcho;
+
+// A copy of the strip taken every time show() is called, with the pixels 
+// held as red, green and blue bytes
+struct HostFrame
+{
+	unsigned long millis;
+	std::vector<uint8_t> pixels;
+};
+
+// Frames are only kept while hostCaptureFrames is set, the count is 
+// always kept
+extern std::vector<HostFrame> hostFrames;
+extern bool hostCaptureFrames;
+extern unsigned long hostShowCount;
+
+// One line per frame: the time in milliseconds, then RRGGBB in hex for 
+// each pixel
+std::string hostFrameText(const HostFrame & frame);
+std::string hostFramesText(const std::vector<HostFrame> & frames);
+
+// Writes the frames as a binary PPM image with one row of pixels per 
+// frame, each pixel drawn scale pixels wide and high
+bool hostWriteFramesPpm(const char * path, const std::vector<HostFrame> & frames, int scale);
+
+extern uint8_t hostEeprom[];
+extern unsigned long hostEepromReads;
+extern unsigned long hostEepromWrites;
+
+#endif
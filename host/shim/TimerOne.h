@@ -0,0 +1,20 @@
+// Host replacement for the TimerOne library. The timer never fires, so the
+// motors do not step on the host.
+
+#ifndef HOST_TIMERONE_H
+#define HOST_TIMERONE_H
+
+#include "Arduino.h"
+
+class TimerOne
+{
+public:
+	void initialize(long microseconds = 1000000) {}
+	void setPeriod(long microseconds) {}
+	void attachInterrupt(void(*isr)(), long microseconds = -1) {}
+	void detachInterrupt() {}
+};
+
+extern TimerOne Timer1;
+
+#endif
@@ -0,0 +1,157 @@
+// Tests for the named colour table in PixelControl.h. Built twice, with 
+// and without FULL_COLOUR_TABLE.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+// The robot colours as the selectColour switch set them before there was 
+// a colour table
+
+const struct
+{
+	lightColor colour;
+	const char * name;
+	byte r, g, b;
+} robotColours[] = {
+	{ red, "red", 255, 0, 0 },
+	{ blue, "blue", 0, 0, 255 },
+	{ green, "green", 0, 255, 0 },
+	{ lilac, "lilac", 220, 208, 255 },
+	{ cyan, "cyan", 0, 255, 255 },
+	{ pink, "pink", 255, 105, 180 },
+	{ lavender, "lavender", 230, 230, 250 },
+	{ plum, "plum", 221, 160, 221 },
+	{ lime, "lime", 50, 205, 50 },
+	{ orange, "orange", 255, 165, 0 },
+	{ powder_blue, "powderblue", 176, 224, 230 },
+	{ purple, "purple", 128, 0, 128 },
+	{ teal, "teal", 0, 128, 128 }
+};
+
+#define NO_OF_TESTED_ROBOT_COLOURS (sizeof(robotColours) / sizeof(robotColours[0]))
+
+void testRobotColours()
+{
+	HOST_CHECK_EQUAL(NO_OF_TESTED_ROBOT_COLOURS, NO_OF_ROBOT_COLOURS);
+
+	for (byte i = 0; i < NO_OF_TESTED_ROBOT_COLOURS; i++)
+	{
+		byte r, g, b;
+
+		HOST_CHECK_EQUAL(i, robotColours[i].colour);
+
+		selectColour(robotColours[i].colour, &r, &g, &b);
+		HOST_CHECK_EQUAL(robotColours[i].r, r);
+		HOST_CHECK_EQUAL(robotColours[i].g, g);
+		HOST_CHECK_EQUAL(robotColours[i].b, b);
+
+		HOST_CHECK_EQUAL(robotColours[i].colour, findColourByName(robotColours[i].name));
+	}
+}
+
+// Every name in the table is found at its own position, so the names and 
+// values are in step, and no name is there twice
+
+void testNamesMatchValues()
+{
+	std::string names(colourNames);
+	size_t start = 0;
+	int colourNo = 0;
+
+	while (start <= names.size())
+	{
+		size_t end = names.find(',', start);
+		if (end == std::string::npos)
+			end = names.size();
+
+		std::string name = names.substr(start, end - start);
+
+		HOST_CHECK(!name.empty());
+		if (!HOST_CHECK_EQUAL(colourNo, findColourByName(name.c_str())))
+			printf("  colour name %s\n", name.c_str());
+
+		colourNo++;
+		start = end + 1;
+	}
+
+	HOST_CHECK_EQUAL(NO_OF_COLOURS, colourNo);
+
+#ifdef FULL_COLOUR_TABLE
+	HOST_CHECK_EQUAL(142, NO_OF_COLOURS);
+#else
+	HOST_CHECK_EQUAL(NO_OF_ROBOT_COLOURS, NO_OF_COLOURS);
+#endif
+}
+
+void testNameMatching()
+{
+	// upper case, and ended by anything that is not a letter
+	HOST_CHECK_EQUAL(blue, findColourByName("BLUE"));
+	HOST_CHECK_EQUAL(blue, findColourByName("Blue,10"));
+	HOST_CHECK_EQUAL(teal, findColourByName("teal\r"));
+
+	// the whole name must match
+	HOST_CHECK_EQUAL(-1, findColourByName("blu"));
+	HOST_CHECK_EQUAL(-1, findColourByName("bluee"));
+	HOST_CHECK_EQUAL(-1, findColourByName("nosuchcolour"));
+	HOST_CHECK_EQUAL(-1, findColourByName(""));
+
+#ifdef FULL_COLOUR_TABLE
+	byte r, g, b;
+	HOST_CHECK(getColourFromTable(findColourByName("blueviolet"), &r, &g, &b));
+	HOST_CHECK_EQUAL(138, r);
+	HOST_CHECK_EQUAL(43, g);
+	HOST_CHECK_EQUAL(226, b);
+#else
+	HOST_CHECK_EQUAL(-1, findColourByName("blueviolet"));
+#endif
+}
+
+void testTableLimits()
+{
+	byte r = 1, g = 2, b = 3;
+
+	HOST_CHECK(!getColourFromTable(-1, &r, &g, &b));
+	HOST_CHECK(!getColourFromTable(NO_OF_COLOURS, &r, &g, &b));
+	HOST_CHECK(getColourFromTable(NO_OF_COLOURS - 1, &r, &g, &b));
+}
+
+void testRandomColours()
+{
+	seedRandom(RANDOM_DEFAULT_SEED);
+
+	bool picked[NO_OF_ROBOT_COLOURS];
+	memset(picked, 0, sizeof(picked));
+
+	for (int i = 0; i < 1000; i++)
+	{
+		byte r, g, b;
+		pickRandomColour(&r, &g, &b);
+
+		bool found = false;
+		for (byte c = 0; c < NO_OF_TESTED_ROBOT_COLOURS; c++)
+		{
+			if (r == robotColours[c].r && g == robotColours[c].g && b == robotColours[c].b)
+			{
+				picked[c] = true;
+				found = true;
+			}
+		}
+		HOST_CHECK(found);
+	}
+
+	for (byte c = 0; c < NO_OF_ROBOT_COLOURS; c++)
+		HOST_CHECK(picked[c]);
+}
+
+int main()
+{
+	testRobotColours();
+	testNamesMatchValues();
+	testNameMatching();
+	testTableLimits();
+	testRandomColours();
+
+	return hostTestResult("ColourTableTest");
+}
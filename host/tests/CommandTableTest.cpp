@@ -0,0 +1,46 @@
+// Checks that the command lookup agrees with the command table. The 
+// lookup is a switch on the letters, so a command added to the table but 
+// not to the switch would never run from the host.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+inline char lowerCase(char ch)
+{
+	if (ch >= 'A' && ch <= 'Z')
+		return ch - 'A' + 'a';
+	return ch;
+}
+
+void testEveryCommandFound()
+{
+	HOST_CHECK_EQUAL(NO_OF_COMMAND_NUMBERS, NO_OF_COMMANDS);
+
+	for (byte i = 0; i < NO_OF_COMMANDS; i++)
+	{
+		char group = pgm_read_byte(&commandTable[i].group);
+		char command = pgm_read_byte(&commandTable[i].command);
+
+		HOST_CHECK_EQUAL(i, findCommand(group, command));
+		HOST_CHECK_EQUAL(i, findCommand(lowerCase(group), lowerCase(command)));
+	}
+}
+
+void testUnknownCommands()
+{
+	HOST_CHECK_EQUAL(-1, findCommand('X', 'X'));
+	HOST_CHECK_EQUAL(-1, findCommand('P', 'Z'));
+	HOST_CHECK_EQUAL(-1, findCommand('P', 0));
+	HOST_CHECK_EQUAL(-1, findCommand('#', 'P'));
+}
+
+int main()
+{
+	hostStartFirmware();
+
+	testEveryCommandFound();
+	testUnknownCommands();
+
+	return hostTestResult("CommandTableTest");
+}
@@ -0,0 +1,177 @@
+// Tests for the binary frame uploads, PB and PD. A packet that is rejected
+// part way through must be thrown away, so that none of its bytes are
+// taken for commands. A frame that is shown must not be drawn over by a 
+// light mode.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+bool outputContains(const char * text)
+{
+	return hostSerialOutput.find(text) != std::string::npos;
+}
+
+// Adds the checksum, the low byte of the sum of the bytes, and sends the
+// packet after its command
+
+void sendPacket(const char * command, std::string packet)
+{
+	byte checksum = 0;
+
+	for (size_t i = 0; i < packet.size(); i++)
+		checksum += (byte)packet[i];
+
+	packet += (char)checksum;
+
+	hostSerialSend(std::string(command) + '\r' + packet);
+	hostRun(1);
+}
+
+// Pixel data that would run IV, which always prints the version, if it
+// were read as commands
+
+std::string commandBytes(size_t length)
+{
+	std::string bytes;
+
+	while (bytes.size() < length)
+		bytes += "IV\r";
+
+	return bytes.substr(0, length);
+}
+
+void testFrameShown()
+{
+	std::string packet;
+	packet += (char)2;
+	packet += "\x10\x20\x30\x40\x50\x60";
+
+	hostSerialOutput.clear();
+	sendPacket("PB", packet);
+
+	HOST_CHECK(outputContains("PBOK"));
+	HOST_CHECK_EQUAL(0x102030, strip.getPixelColor(0));
+	HOST_CHECK_EQUAL(0x405060, strip.getPixelColor(1));
+	HOST_CHECK(rawFrameMode);
+	HOST_CHECK_EQUAL(ACCEPTING_COMMANDS, deviceState);
+}
+
+// A full frame with too many pixels is thrown away up to its checksum,
+// and the commands after it are read as normal
+
+void testTooManyPixelsDiscarded()
+{
+	std::string packet;
+	packet += (char)(PIXELS + 1);
+	packet += commandBytes((PIXELS + 1) * 3);
+
+	hostSerialOutput.clear();
+	sendPacket("PB", packet);
+
+	HOST_CHECK(outputContains("PBFail: too many pixels"));
+	HOST_CHECK(!outputContains("Version"));
+	HOST_CHECK(!rawFrameMode);
+	HOST_CHECK_EQUAL(ACCEPTING_COMMANDS, deviceState);
+
+	hostCommand("IV");
+	hostRun(1);
+
+	HOST_CHECK(outputContains("Version"));
+}
+
+// A delta frame with a bad run is thrown away until the host goes quiet,
+// as its length is not known. The bytes after the bad run would stop the
+// motors, turn the pixels off and print the version if they were read as
+// commands.
+
+void testBadDeltaRunDiscarded(byte runStart, byte runLength)
+{
+	std::string packet;
+	packet += (char)2;
+	packet += (char)runStart;
+	packet += (char)runLength;
+	packet += "MS\rPO\rIV\rPN\r\x0D\x0D";
+
+	hostSerialOutput.clear();
+	sendPacket("PD", packet);
+
+	HOST_CHECK(outputContains("PDFail: bad run"));
+	HOST_CHECK(!outputContains("MSOK"));
+	HOST_CHECK(!outputContains("POOK"));
+	HOST_CHECK(!outputContains("Version"));
+	HOST_CHECK(!rawFrameMode);
+
+	// still discarding until the host has been quiet for long enough
+	HOST_CHECK_EQUAL(RECEIVING_FRAME, deviceState);
+
+	hostCommand("IV");
+	hostRun(FRAME_BYTE_TIMEOUT_MILLIS / 2);
+
+	HOST_CHECK(!outputContains("Version"));
+
+	hostRun(FRAME_BYTE_TIMEOUT_MILLIS + 2);
+
+	HOST_CHECK_EQUAL(ACCEPTING_COMMANDS, deviceState);
+
+	hostCommand("IV");
+	hostRun(1);
+
+	HOST_CHECK(outputContains("Version"));
+}
+
+// A light mode running in another segment is stopped by the upload, so 
+// new distance readings do not draw over the frame
+
+void testLightModeStoppedByFrame()
+{
+	hostCommand("PE6");
+	hostCommand("PS1");
+	hostCommand("PL2");
+	hostCommand("PS0");
+	hostRun(1);
+
+	hostEchoPulse(echoPin, 150 * 58);
+	hostRun(2 * TICK_INTERVAL);
+
+	HOST_CHECK_EQUAL(lightModeProximity, lightMode);
+	HOST_CHECK_EQUAL(1, lightModeSegment);
+
+	std::string packet;
+	packet += (char)PIXELS;
+
+	for (byte i = 0; i < PIXELS; i++)
+		packet += "\x10\x20\x30";
+
+	hostSerialOutput.clear();
+	sendPacket("PB", packet);
+
+	HOST_CHECK(outputContains("PBOK"));
+	HOST_CHECK_EQUAL(lightModeManual, lightMode);
+
+	hostEchoPulse(echoPin, 5 * 58);
+	hostRun(2 * TICK_INTERVAL);
+
+	HOST_CHECK(rawFrameMode);
+
+	for (byte i = 0; i < PIXELS; i++)
+		HOST_CHECK_EQUAL(0x102030, strip.getPixelColor(i));
+
+	hostCommand("PE");
+	hostRun(1);
+}
+
+int main()
+{
+	hostStartFirmware();
+
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+
+	testFrameShown();
+	testTooManyPixelsDiscarded();
+	testBadDeltaRunDiscarded(PIXELS + 5, 1);
+	testBadDeltaRunDiscarded(0, PIXELS + 1);
+	testLightModeStoppedByFrame();
+
+	return hostTestResult("FrameUploadTest");
+}
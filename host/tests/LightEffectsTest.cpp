@@ -0,0 +1,92 @@
+// Golden frame tests for the light effects. Each effect is started with 
+// the same commands a host would send, the firmware is run for a while 
+// and every frame sent to the strip is compared with a known good copy 
+// in host/golden. A command of +nnn runs the firmware for nnn ms before 
+// the commands after it are sent.
+// LightEffectsTest name runs one effect in a newly started firmware. 
+// Builds with other settings add GOLDEN_SUFFIX to the golden file names.
+// After a deliberate change to the look of an effect, check the new frames 
+// with the pixel simulator and rebuild the golden files by running the 
+// tests with UPDATE_GOLDEN=1 set.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+#ifndef GOLDEN_SUFFIX
+#define GOLDEN_SUFFIX ""
+#endif
+
+struct LightEffect
+{
+	const char * name;
+	const char * commands[10];
+	unsigned long runMillis;
+};
+
+const LightEffect lightEffects[] = {
+	{ "startup", { NULL }, 1400 },
+	{ "candle", { "PC255,0,0" }, 600 },
+	{ "named_colour", { "PNblue" }, 100 },
+	{ "colour_number", { "PN4" }, 100 },
+	{ "single_pixel", { "PO", "PI3,0,255,0" }, 100 },
+	{ "fade_linear", { "PC255,0,0", "PX20,0,0,255" }, 1100 },
+	{ "fade_ease_in_out", { "PC255,0,0", "PX20,blue,3" }, 1100 },
+	{ "fade_exponential", { "PC255,0,0", "PX20,blue,4" }, 1100 },
+	{ "sparkle", { "CS1234", "PR" }, 1000 },
+	{ "move_wrap", { "PO", "PI0,255,0,0", "PM0,8,1" }, 1000 },
+	{ "move_bounce", { "PO", "PI0,0,0,255", "PM1,12,1,2,8" }, 1000 },
+	{ "hue_cycle", { "PH0,255,128,16" }, 1000 },
+	{ "rainbow", { "PW8" }, 1000 },
+	{ "blend_add", { "PNred", "PM0,16,1" }, 200 },
+	{ "blend_max", { "PA1", "PNred", "PM0,16,1" }, 200 },
+	{ "gamma_off", { "PG0", "PH60,255,40,4" }, 600 },
+	{ "dim_dither", { "PO", "PI0,3,2,1", "PI6,1,1,1" }, 300 },
+	{ "dither_settle", { "PO", "PI0,3,2,1", "PI6,1,1,1" }, 6000 },
+	{ "power_budget", { "PP100", "PH0,0,255" }, 100 },
+	{ "segments", { "PE4,8", "PS0", "PNred", "PS1,40", "PW8", "PS2,10", "PNblue", "PM0,8,1" }, 1000 },
+	{ "segment_fades", { "PE6", "PC255,0,0", "PS1", "PC0,255,0", "PS0", "PX18,blue", "+400", "PS1", "PX20,0,0,255,1" }, 2800 },
+	{ "motion_mode", { "PL1" }, 200 }
+};
+
+#define NO_OF_LIGHT_EFFECTS (sizeof(lightEffects) / sizeof(struct LightEffect))
+
+void runLightEffect(const LightEffect * effect)
+{
+	hostFrames.clear();
+	hostCaptureFrames = true;
+
+	hostStartFirmware();
+
+	for (byte i = 0; i < 10 && effect->commands[i] != NULL; i++)
+	{
+		if (effect->commands[i][0] == '+')
+			hostRun(atol(effect->commands[i] + 1));
+		else
+			hostCommand(effect->commands[i]);
+	}
+
+	hostRun(effect->runMillis);
+
+	hostCaptureFrames = false;
+
+	hostCheckGolden((std::string(effect->name) + GOLDEN_SUFFIX).c_str(), hostFramesText(hostFrames));
+}
+
+int main(int argc, char ** argv)
+{
+	for (size_t i = 0; i < NO_OF_LIGHT_EFFECTS; i++)
+	{
+		if (argc > 1 && strcmp(argv[1], lightEffects[i].name) == 0)
+		{
+			runLightEffect(&lightEffects[i]);
+			return hostTestResult(argv[1]);
+		}
+	}
+
+	printf("Usage: LightEffectsTest effect\nEffects:");
+	for (size_t i = 0; i < NO_OF_LIGHT_EFFECTS; i++)
+		printf(" %s", lightEffects[i].name);
+	printf("\n");
+	return 1;
+}
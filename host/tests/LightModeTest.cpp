@@ -0,0 +1,127 @@
+// Tests for the light modes in LightModes.h. The distance sensor is driven
+// through the echo pin, so the readings reach the proximity mode the same
+// way as they do on the robot.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+// Sends the echo for an obstacle at the given distance and gives the mode
+// time to draw it
+
+void obstacleAt(unsigned long cm)
+{
+	hostEchoPulse(echoPin, cm * 58);
+	hostRun(2 * TICK_INTERVAL);
+}
+
+// The strip is dimmed by the power budget, so only the components that are 
+// lit are compared
+
+void checkStripColour(byte pixel, byte r, byte g, byte b)
+{
+	uint32_t colour = strip.getPixelColor(pixel);
+
+	HOST_CHECK_EQUAL(r != 0, (byte)(colour >> 16) != 0);
+	HOST_CHECK_EQUAL(g != 0, (byte)(colour >> 8) != 0);
+	HOST_CHECK_EQUAL(b != 0, (byte)colour != 0);
+}
+
+// Checks that the first litLights lights show the colour, on the lights
+// and on the strip, and that the rest are off
+
+void checkProximityLights(byte litLights, byte r, byte g, byte b)
+{
+	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+	{
+		if (i < litLights)
+		{
+			HOST_CHECK(lights[i].lightState != lightStateOff);
+			HOST_CHECK_EQUAL(r, lights[i].r);
+			HOST_CHECK_EQUAL(g, lights[i].g);
+			HOST_CHECK_EQUAL(b, lights[i].b);
+			checkStripColour(i, r, g, b);
+		}
+		else
+		{
+			HOST_CHECK_EQUAL(lightStateOff, lights[i].lightState);
+			HOST_CHECK_EQUAL(0, strip.getPixelColor(i));
+		}
+	}
+}
+
+// Near obstacles light the whole ring in red, ones half way light half of
+// it in yellow and distant ones light a single green light
+
+void testProximityDistances()
+{
+	hostCommand("PL2,10,100");
+	hostRun(1);
+
+	HOST_CHECK_EQUAL(lightModeProximity, lightMode);
+
+	obstacleAt(5);
+	HOST_CHECK_EQUAL(5, getDistanceValueInt());
+	checkProximityLights(NO_OF_LIGHTS, 255, 0, 0);
+
+	obstacleAt(55);
+	HOST_CHECK_EQUAL(55, getDistanceValueInt());
+	checkProximityLights(1 + (NO_OF_LIGHTS - 1) / 2, 255, 255, 0);
+
+	obstacleAt(150);
+	HOST_CHECK_EQUAL(150, getDistanceValueInt());
+	checkProximityLights(1, 0, 255, 0);
+
+	obstacleAt(10);
+	checkProximityLights(NO_OF_LIGHTS, 255, 0, 0);
+}
+
+// Once the mode is turned off the readings no longer reach the lights
+
+void testProximityOff()
+{
+	hostCommand("PL2");
+	hostRun(1);
+	obstacleAt(150);
+	checkProximityLights(1, 0, 255, 0);
+
+	hostCommand("PL0");
+	hostRun(1);
+
+	HOST_CHECK_EQUAL(lightModeManual, lightMode);
+
+	obstacleAt(5);
+	checkProximityLights(1, 0, 255, 0);
+}
+
+// A pixel command that sets the lights puts the mode back to manual
+
+void testPixelCommandStopsProximity()
+{
+	hostCommand("PL2");
+	hostRun(1);
+	obstacleAt(150);
+
+	hostCommand("PNblue");
+	hostRun(1);
+
+	HOST_CHECK_EQUAL(lightModeManual, lightMode);
+
+	obstacleAt(5);
+
+	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+		checkStripColour(i, 0, 0, 255);
+}
+
+int main()
+{
+	hostStartFirmware();
+
+	diagnosticsOutputLevel = 0;
+
+	testProximityDistances();
+	testProximityOff();
+	testPixelCommandStopsProximity();
+
+	return hostTestResult("LightModeTest");
+}
@@ -0,0 +1,351 @@
+// Tests for the colour and movement arithmetic in PixelControl.h
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+void testHsvPrimaries()
+{
+	const struct
+	{
+		uint16_t hue;
+		byte r, g, b;
+	} primaries[] = {
+		{ 0, 255, 0, 0 },
+		{ 256, 255, 255, 0 },
+		{ 512, 0, 255, 0 },
+		{ 768, 0, 255, 255 },
+		{ 1024, 0, 0, 255 },
+		{ 1280, 255, 0, 255 }
+	};
+
+	for (byte i = 0; i < 6; i++)
+	{
+		byte r, g, b;
+		hsvToRgb(primaries[i].hue, 255, 255, &r, &g, &b);
+		HOST_CHECK_EQUAL(primaries[i].r, r);
+		HOST_CHECK_EQUAL(primaries[i].g, g);
+		HOST_CHECK_EQUAL(primaries[i].b, b);
+	}
+}
+
+void testHsvGreyAndBlack()
+{
+	for (uint16_t hue = 0; hue < HUE_RANGE; hue += 37)
+	{
+		byte r, g, b;
+
+		hsvToRgb(hue, 0, 200, &r, &g, &b);
+		HOST_CHECK_EQUAL(200, r);
+		HOST_CHECK_EQUAL(200, g);
+		HOST_CHECK_EQUAL(200, b);
+
+		hsvToRgb(hue, 255, 0, &r, &g, &b);
+		HOST_CHECK_EQUAL(0, r);
+		HOST_CHECK_EQUAL(0, g);
+		HOST_CHECK_EQUAL(0, b);
+	}
+}
+
+// Going round the wheel a step at a time the colour must never jump, 
+// and a fully saturated colour always has one component full and one off
+
+void testHsvWheelIsSmooth()
+{
+	byte lastR, lastG, lastB;
+	hsvToRgb(HUE_RANGE - 1, 255, 255, &lastR, &lastG, &lastB);
+
+	for (uint16_t hue = 0; hue < HUE_RANGE; hue++)
+	{
+		byte r, g, b;
+		hsvToRgb(hue, 255, 255, &r, &g, &b);
+
+		HOST_CHECK(abs(r - lastR) <= 2 && abs(g - lastG) <= 2 && abs(b - lastB) <= 2);
+		HOST_CHECK_EQUAL(255, max(r, max(g, b)));
+		HOST_CHECK_EQUAL(0, min(r, min(g, b)));
+
+		lastR = r;
+		lastG = g;
+		lastB = b;
+	}
+}
+
+void testHueFromDegrees()
+{
+	HOST_CHECK_EQUAL(0, hueFromDegrees(0));
+	HOST_CHECK_EQUAL(512, hueFromDegrees(120));
+	HOST_CHECK_EQUAL(1024, hueFromDegrees(240));
+	HOST_CHECK_EQUAL(0, hueFromDegrees(360));
+	HOST_CHECK_EQUAL(1024, hueFromDegrees(-120));
+	HOST_CHECK_EQUAL(4, hueFromDegrees(721));
+}
+
+/////////////////////////////////////////////
+//  Light movement
+/////////////////////////////////////////////
+
+void placeLight(byte lightNo, byte mode, int pos, int8_t dist, int posMin, int posMax)
+{
+	lights[lightNo].moveMode = mode;
+	lights[lightNo].pos = pos;
+	lights[lightNo].moveDist = dist;
+	lights[lightNo].moveSpeed = 1;
+	lights[lightNo].posMin = posMin;
+	lights[lightNo].posMax = posMax;
+}
+
+void testWrap()
+{
+	resetSegments();
+	tickCount = 0;
+
+	// off the top of the strip and back in at the bottom
+	placeLight(0, moveWrap, LIGHT_POSITIONS - 4, 8, 0, 0);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(4, lights[0].pos);
+	HOST_CHECK_EQUAL(8, lights[0].moveDist);
+
+	// and the other way
+	placeLight(0, moveWrap, 2, -8, 0, 0);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(LIGHT_POSITIONS - 6, lights[0].pos);
+
+	// inside a range
+	placeLight(0, moveWrap, 6 * NO_OF_GAPS - 4, 8, 2 * NO_OF_GAPS, 6 * NO_OF_GAPS);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(2 * NO_OF_GAPS + 4, lights[0].pos);
+
+	// a range off the end of the strip is cut back to the strip
+	placeLight(0, moveWrap, LIGHT_POSITIONS - 1, 1, 0, LIGHT_POSITIONS + 100);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(0, lights[0].pos);
+}
+
+void testBounce()
+{
+	resetSegments();
+	tickCount = 0;
+
+	// the top of a bouncing light is the last pixel, so that it is never 
+	// drawn across the join
+	int top = LIGHT_POSITIONS - NO_OF_GAPS;
+
+	placeLight(0, moveBounce, top - 4, 8, 0, 0);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(top - 4, lights[0].pos);
+	HOST_CHECK_EQUAL(-8, lights[0].moveDist);
+
+	placeLight(0, moveBounce, 4, -8, 0, 0);
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(4, lights[0].pos);
+	HOST_CHECK_EQUAL(8, lights[0].moveDist);
+
+	// a move longer than the range stays inside it
+	placeLight(0, moveBounce, 2 * NO_OF_GAPS, 32, 2 * NO_OF_GAPS, 2 * NO_OF_GAPS + 8);
+	for (byte i = 0; i < 10; i++)
+	{
+		updateLightPosition(0);
+		HOST_CHECK(lights[0].pos >= 2 * NO_OF_GAPS && lights[0].pos <= 2 * NO_OF_GAPS + 8);
+	}
+}
+
+void testMovesStayInSegment()
+{
+	byte edges[] = { 4, 8 };
+	HOST_CHECK(splitSegments(edges, 2));
+
+	byte lightNo = segments[1].firstLight;
+	int low = segments[1].firstPixel * NO_OF_GAPS;
+	int high = segments[1].pixelLimit * NO_OF_GAPS;
+
+	selectSegment(1);
+
+	for (byte mode = moveWrap; mode <= moveBounce; mode++)
+	{
+		placeLight(lightNo, mode, low, 7, 0, 0);
+
+		for (int tick = 0; tick < 500; tick++)
+		{
+			tickCount = tick;
+			updateLightPosition(lightNo);
+			HOST_CHECK(lights[lightNo].pos >= low && lights[lightNo].pos < high);
+		}
+	}
+
+	resetSegments();
+}
+
+void testMoveSpeed()
+{
+	resetSegments();
+
+	placeLight(0, moveWrap, 0, 8, 0, 0);
+	lights[0].moveSpeed = 3;
+
+	for (tickCount = 1; tickCount <= 9; tickCount++)
+		updateLightPosition(0);
+
+	// moves on ticks 3, 6 and 9
+	HOST_CHECK_EQUAL(24, lights[0].pos);
+
+	lights[0].moveSpeed = 0;
+	updateLightPosition(0);
+	HOST_CHECK_EQUAL(24, lights[0].pos);
+}
+
+/////////////////////////////////////////////
+//  Transition clocks
+/////////////////////////////////////////////
+
+// A fade started in one segment must not restart the fade in another
+
+void testSegmentTransitionClocks()
+{
+	byte edges[] = { 6 };
+	HOST_CHECK(splitSegments(edges, 1));
+
+	selectSegment(0);
+	startTransition(1000, curveLinear);
+
+	hostAdvanceMillis(500);
+	updateSegment(0);
+	HOST_CHECK_EQUAL(128, segments[0].transitionLevel);
+
+	selectSegment(1);
+	startTransition(1000, curveLinear);
+	HOST_CHECK(!transitionComplete());
+
+	hostAdvanceMillis(250);
+	updateSegment(0);
+	updateSegment(1);
+	HOST_CHECK_EQUAL(192, segments[0].transitionLevel);
+	HOST_CHECK_EQUAL(64, segments[1].transitionLevel);
+
+	hostAdvanceMillis(250);
+	updateSegment(0);
+	updateSegment(1);
+	HOST_CHECK(!segments[0].transitionRunning);
+	HOST_CHECK_EQUAL(256, segments[0].transitionLevel);
+	HOST_CHECK(segments[1].transitionRunning);
+
+	selectSegment(0);
+	HOST_CHECK(transitionComplete());
+	selectSegment(1);
+	HOST_CHECK(!transitionComplete());
+
+	resetSegments();
+}
+
+// Random transitions start again in the segment whose fade ended, and 
+// leave the other segment alone
+
+void testRandomTransitionsPerSegment()
+{
+	byte edges[] = { 6 };
+	HOST_CHECK(splitSegments(edges, 1));
+
+	segments[1].randomTransitions = true;
+
+	updateLightsAndDelay(false);
+	HOST_CHECK(segments[1].transitionRunning);
+	HOST_CHECK(!segments[0].transitionRunning);
+
+	unsigned long started = segments[1].transitionStartMillis;
+
+	hostAdvanceMillis(segments[1].transitionMillis);
+	updateLightsAndDelay(false);
+	HOST_CHECK(segments[1].transitionRunning);
+	HOST_CHECK(segments[1].transitionStartMillis != started);
+	HOST_CHECK(!segments[0].transitionRunning);
+
+	resetSegments();
+}
+
+// The flicker step is worked out in 16 bits unsigned, so the fastest 
+// flicker over the full range gives the same steps as long arithmetic 
+// and none of them is out of range. An int multiply would overflow on 
+// the AVR, which the 32 bit host cannot show, so the result is checked 
+// against the long sum.
+
+void testFlickerStepRange()
+{
+	setFlickerUpdateSpeed(20);
+	HOST_CHECK_EQUAL(1, flickerUpdateSpeed);
+
+	for (byte i = 0; i < NO_OF_LIGHTS; i++)
+	{
+		long expected = 1 + ((255L * flickerNoiseAt((uint16_t)i * FLICKER_PHASE_SPREAD)) >> 8);
+		if (expected > 127)
+			expected = 127;
+
+		int8_t step = flickerStep(i, 0, 255);
+		HOST_CHECK_EQUAL(expected, step);
+		HOST_CHECK(step >= 1 && step <= 127);
+	}
+
+	// a range that is empty or upside down still flickers slowly
+	HOST_CHECK_EQUAL(1, flickerStep(0, 100, 100));
+	HOST_CHECK_EQUAL(1, flickerStep(0, 200, 100));
+
+	setFlickerUpdateSpeed(13);
+}
+
+// Each stage keeps its own count, as the drawing stages are timed once 
+// for each segment, and all of them stop together when one is full
+
+void testStageTimingCounts()
+{
+	byte edges[] = { 6 };
+	HOST_CHECK(splitSegments(edges, 1));
+
+	resetStageTimings();
+
+	for (byte i = 0; i < 3; i++)
+		updateLightsAndDelay(false);
+
+	HOST_CHECK_EQUAL(3, timedFrames);
+	HOST_CHECK_EQUAL(3, stageTimings[lightStageShow].samples);
+	HOST_CHECK_EQUAL(6, stageTimings[lightStageColours].samples);
+	HOST_CHECK_EQUAL(6, stageTimings[lightStageRender].samples);
+
+	stageTimings[lightStageColours].samples = 0xFFFF;
+	unsigned long renderTotal = stageTimings[lightStageRender].totalMicros;
+
+	updateLightsAndDelay(false);
+
+	HOST_CHECK(stageTimingsFull);
+	HOST_CHECK_EQUAL(3, timedFrames);
+	HOST_CHECK_EQUAL(3, stageTimings[lightStageShow].samples);
+	HOST_CHECK_EQUAL(6, stageTimings[lightStageRender].samples);
+	HOST_CHECK_EQUAL(renderTotal, stageTimings[lightStageRender].totalMicros);
+
+	resetStageTimings();
+
+	HOST_CHECK(!stageTimingsFull);
+	HOST_CHECK_EQUAL(0, stageTimings[lightStageColours].samples);
+
+	resetSegments();
+}
+
+int main()
+{
+	startLights();
+
+	testHsvPrimaries();
+	testHsvGreyAndBlack();
+	testHsvWheelIsSmooth();
+	testHueFromDegrees();
+
+	testWrap();
+	testBounce();
+	testMovesStayInSegment();
+	testMoveSpeed();
+
+	testSegmentTransitionClocks();
+	testRandomTransitionsPerSegment();
+
+	testFlickerStepRange();
+	testStageTimingCounts();
+
+	return hostTestResult("PixelMathTest");
+}
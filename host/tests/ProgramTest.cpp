@@ -0,0 +1,256 @@
+// Tests for stored programs: a program downloaded with RM and RX is
+// compiled, listed back with IP and run from its bytecode.
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+// Downloads the program, one statement to a line, and lets it start
+
+void downloadProgram(const char * const * statements)
+{
+	hostCommand("RM");
+
+	for (byte i = 0; statements[i] != NULL; i++)
+		hostCommand(statements[i]);
+
+	hostCommand("RX");
+	hostRun(10);
+}
+
+std::string listProgram()
+{
+	hostSerialOutput.clear();
+	hostCommand("IP");
+	hostRun(1);
+	return hostSerialOutput;
+}
+
+bool outputContains(const char * text)
+{
+	return hostSerialOutput.find(text) != std::string::npos;
+}
+
+// The listing of a program is the text that was downloaded
+
+void testListingMatchesDownload()
+{
+	const char * const program[] = {
+		"#light show",
+		"CLtop",
+		"PC255,0,0",
+		"PX1,blue,3",
+		"PI0,10,20,30",
+		"PH-40,255,128,1",
+		"CM10,close",
+		"CTtop",
+		"CD100",
+		"CJtop",
+		"CLclose",
+		"PN3",
+		"CJtop",
+		NULL
+	};
+
+	std::string expected = "Current program: \r\n";
+
+	for (byte i = 0; program[i] != NULL; i++)
+		expected += std::string(program[i]) + "\r\n";
+
+	expected += "Reached end of program\r\n";
+
+	diagnosticsOutputLevel = 0;
+	downloadProgram(program);
+
+	HOST_CHECK(listProgram() == expected);
+}
+
+// The values in a statement reach the command in order, including when
+// a command reads them with more than one call of readArguments
+
+void testValuesReachCommands()
+{
+	const char * const program[] = {
+		"CB1234",
+		"PI2,10,20,30",
+		"CLend",
+		"CD1000",
+		"CJend",
+		NULL
+	};
+
+	diagnosticsOutputLevel = 0;
+	downloadProgram(program);
+
+	HOST_CHECK_EQUAL(1234, programTimeBudget);
+	HOST_CHECK_EQUAL(10, lights[2].r);
+	HOST_CHECK_EQUAL(20, lights[2].g);
+	HOST_CHECK_EQUAL(30, lights[2].b);
+
+	programTimeBudget = DEFAULT_PROGRAM_TIME_BUDGET;
+}
+
+// The token bytes are only tokens in a stored program. A command from the
+// host that contains them is read as text.
+
+void testRemoteTokenBytesAreText()
+{
+	const char * const program[] = {
+		"CLtop",
+		"CD1000",
+		"CJtop",
+		NULL
+	};
+
+	diagnosticsOutputLevel = 0;
+	downloadProgram(program);
+	haltProgramExecution();
+
+	// an integer token for 1000
+	hostSerialSend(std::string("CB\x01\xE8\x03\r"));
+	hostRun(1);
+
+	HOST_CHECK_EQUAL(0, programTimeBudget);
+
+	// a label token for the first statement, which is the label
+	int savedCounter = programCounter;
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+	hostSerialOutput.clear();
+
+	hostSerialSend(std::string("CJ\x02\x0A\x01\r"));
+	hostRun(1);
+
+	HOST_CHECK(outputContains("CJFAIL: no dest"));
+	HOST_CHECK_EQUAL(savedCounter, programCounter);
+
+	diagnosticsOutputLevel = 0;
+	programTimeBudget = DEFAULT_PROGRAM_TIME_BUDGET;
+}
+
+// A statement can hold no more values than a command can read
+
+void testTooManyValuesRejected()
+{
+	const char * const program[] = {
+		"PF1,2,3,4,5",
+		"PF1,2,3,4,5,6",
+		NULL
+	};
+
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+	hostSerialOutput.clear();
+	downloadProgram(program);
+
+	HOST_CHECK(outputContains("RXFail line 2: too many numbers"));
+
+	diagnosticsOutputLevel = 0;
+
+	HOST_CHECK(listProgram() == "Current program: \r\nPF1,2,3,4,5\r\nReached end of program\r\n");
+}
+
+// A line can be up to COMMAND_BUFFER_SIZE - 1 characters. A longer line
+// is reported with its line number and left out, apart from a comment,
+// which is cut short.
+
+void testLongLines()
+{
+	std::string longestLabel = "CL" + std::string(COMMAND_BUFFER_SIZE - 3, 'a');
+	std::string tooLongLabel = "CL" + std::string(COMMAND_BUFFER_SIZE - 2, 'b');
+	std::string longComment = "#" + std::string(COMMAND_BUFFER_SIZE + 50, 'c');
+
+	const char * const program[] = {
+		longestLabel.c_str(),
+		tooLongLabel.c_str(),
+		longComment.c_str(),
+		"PN3",
+		NULL
+	};
+
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+	hostSerialOutput.clear();
+	downloadProgram(program);
+
+	HOST_CHECK(outputContains("RXFail line 2: line too long"));
+	HOST_CHECK(!outputContains("RXFail line 3"));
+
+	diagnosticsOutputLevel = 0;
+
+	std::string expected = "Current program: \r\n" + longestLabel + "\r\n" +
+		longComment.substr(0, COMMAND_BUFFER_SIZE - 1) + "\r\nPN3\r\nReached end of program\r\n";
+
+	HOST_CHECK(listProgram() == expected);
+}
+
+// A jump must name a label, and CM must give the distance before it
+
+void testJumpLabels()
+{
+	const char * const program[] = {
+		"CM10",
+		"CM10,",
+		"CMclose",
+		"CJ",
+		"CJ10",
+		"CM20,10",
+		"CL10",
+		NULL
+	};
+
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+	hostSerialOutput.clear();
+	downloadProgram(program);
+
+	HOST_CHECK(outputContains("RXFail line 1: number and label expected"));
+	HOST_CHECK(outputContains("RXFail line 2: missing label"));
+	HOST_CHECK(outputContains("RXFail line 3: number and label expected"));
+	HOST_CHECK(outputContains("RXFail line 4: missing label"));
+	HOST_CHECK(!outputContains("Missing label"));
+
+	diagnosticsOutputLevel = 0;
+	haltProgramExecution();
+
+	HOST_CHECK(listProgram() == "Current program: \r\nCJ10\r\nCM20,10\r\nCL10\r\nReached end of program\r\n");
+}
+
+// Blank lines are left out without a report, but still count towards the 
+// line numbers in the reports
+
+void testBlankLinesSkipped()
+{
+	const char * const program[] = {
+		"",
+		"PN3",
+		"",
+		"",
+		"XX",
+		NULL
+	};
+
+	diagnosticsOutputLevel = STATEMENT_CONFIRMATION;
+	hostSerialOutput.clear();
+	downloadProgram(program);
+
+	HOST_CHECK(outputContains("RXFail line 5: invalid command"));
+	HOST_CHECK(!outputContains("RXFail line 1"));
+	HOST_CHECK(!outputContains("RXFail line 3"));
+	HOST_CHECK(!outputContains("RXFail line 4"));
+
+	diagnosticsOutputLevel = 0;
+
+	HOST_CHECK(listProgram() == "Current program: \r\nPN3\r\nReached end of program\r\n");
+}
+
+int main()
+{
+	hostStartFirmware();
+
+	testListingMatchesDownload();
+	testValuesReachCommands();
+	testRemoteTokenBytesAreText();
+	testTooManyValuesRejected();
+	testLongLines();
+	testJumpLabels();
+	testBlankLinesSkipped();
+
+	return hostTestResult("ProgramTest");
+}
@@ -0,0 +1,159 @@
+// Tests for the xorshift generator in RandomNumbers.h
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+void testKnownSequence()
+{
+	// the 7, 9, 8 xorshift from the default seed
+	const uint16_t expected[] = { 0xD30F, 0xF1A5, 0x1734, 0xFF72, 0x1751 };
+
+	seedRandom(RANDOM_DEFAULT_SEED);
+
+	for (byte i = 0; i < 5; i++)
+		HOST_CHECK_EQUAL(expected[i], random16());
+}
+
+void testSeeding()
+{
+	uint16_t first[8];
+
+	seedRandom(1234);
+	for (byte i = 0; i < 8; i++)
+		first[i] = random16();
+
+	seedRandom(1234);
+	for (byte i = 0; i < 8; i++)
+		HOST_CHECK_EQUAL(first[i], random16());
+
+	// a zero seed would stick at zero, so it gives the default sequence
+	seedRandom(0);
+	HOST_CHECK_EQUAL(RANDOM_DEFAULT_SEED, randomState);
+	HOST_CHECK_EQUAL(0xD30F, random16());
+}
+
+// Every state apart from zero comes up once before the sequence repeats
+
+void testFullPeriod()
+{
+	static bool seen[65536];
+	memset(seen, 0, sizeof(seen));
+
+	seedRandom(RANDOM_DEFAULT_SEED);
+
+	long period = 0;
+	bool repeated = false;
+
+	do
+	{
+		uint16_t value = random16();
+		if (value == 0 || seen[value])
+		{
+			repeated = true;
+			break;
+		}
+		seen[value] = true;
+		period++;
+	} while (randomState != RANDOM_DEFAULT_SEED);
+
+	HOST_CHECK(!repeated);
+	HOST_CHECK_EQUAL(65535, period);
+}
+
+void testRandom8IsTopByte()
+{
+	seedRandom(99);
+	uint16_t value = random16();
+
+	seedRandom(99);
+	HOST_CHECK_EQUAL(value >> 8, random8());
+}
+
+void testRangeLimits()
+{
+	const uint16_t limits[] = { 1, 2, 3, 7, 100, 255, 256, 257, 384, 1000, 40000, 65535 };
+
+	seedRandom(RANDOM_DEFAULT_SEED);
+
+	for (byte l = 0; l < sizeof(limits) / sizeof(limits[0]); l++)
+	{
+		uint16_t largest = 0;
+
+		for (int i = 0; i < 5000; i++)
+		{
+			uint16_t value = randomBelow(limits[l]);
+			if (!HOST_CHECK(value < limits[l]))
+				break;
+			if (value > largest)
+				largest = value;
+
+			if (limits[l] <= 256)
+				HOST_CHECK(random8Below(limits[l]) < limits[l]);
+		}
+
+		// small ranges must reach their top value
+		if (limits[l] <= 1000)
+			HOST_CHECK_EQUAL(limits[l] - 1, largest);
+	}
+
+	HOST_CHECK_EQUAL(0, randomBelow(0));
+	HOST_CHECK_EQUAL(0, random8Below(0));
+	HOST_CHECK(random8Below(1000) < 1000);
+
+	for (int i = 0; i < 2000; i++)
+	{
+		int value = randomRange(-3, 4);
+		HOST_CHECK(value >= -3 && value < 4);
+
+		value = randomRange(100, 356);
+		HOST_CHECK(value >= 100 && value < 356);
+
+		value = randomRange(-500, 500);
+		HOST_CHECK(value >= -500 && value < 500);
+	}
+
+	// an empty range gives the minimum
+	HOST_CHECK_EQUAL(5, randomRange(5, 5));
+	HOST_CHECK_EQUAL(5, randomRange(5, 2));
+}
+
+// A range that does not divide 65536 must still give every value the 
+// same chance. With a plain modulus randomBelow(40000) would give the 
+// values below 25536 twice the chance of the rest.
+
+void testNoBias()
+{
+	seedRandom(RANDOM_DEFAULT_SEED);
+
+	long low = 0;
+	long calls = 60000;
+
+	for (long i = 0; i < calls; i++)
+	{
+		if (randomBelow(40000) < 20000)
+			low++;
+	}
+
+	HOST_CHECK(low > calls * 48 / 100 && low < calls * 52 / 100);
+
+	long counts[3] = { 0, 0, 0 };
+
+	for (long i = 0; i < calls; i++)
+		counts[random8Below(3)]++;
+
+	for (byte i = 0; i < 3; i++)
+		HOST_CHECK(counts[i] > calls * 32 / 100 && counts[i] < calls * 35 / 100);
+}
+
+int main()
+{
+	testKnownSequence();
+	testSeeding();
+	testFullPeriod();
+	testRandom8IsTopByte();
+	testRangeLimits();
+	testNoBias();
+
+	return hostTestResult("RandomNumbersTest");
+}
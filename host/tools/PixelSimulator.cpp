@@ -0,0 +1,81 @@
+// Runs the firmware on the PC and captures every frame it sends to the 
+// strip, so that a lighting change can be looked at without a robot.
+//
+// PixelSimulator [-t ms] [-ppm file] [-scale n] [-text file] command...
+//   -t ms       time to run after the last command, default 2000
+//   -ppm file   write the frames as an image, one row of pixels per frame
+//   -scale n    size of each pixel in the image, default 8
+//   -text file  write the frames as text, - for the standard output
+// Each command is sent to the serial port as the host would send it. 
+// A command of +nnn runs the firmware for nnn ms before the next one.
+// Anything the firmware prints goes to the standard error.
+//
+// PixelSimulator -ppm fade.ppm PNred PX20,blue,3
+
+#include "HostHarness.h"
+
+#include "RobotSensorsAndMotors.ino"
+
+int main(int argc, char ** argv)
+{
+	unsigned long runMillis = 2000;
+	const char * ppmPath = NULL;
+	const char * textPath = NULL;
+	int scale = 8;
+
+	hostCaptureFrames = true;
+	hostStartFirmware();
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			runMillis = atol(argv[++i]);
+		else if (strcmp(argv[i], "-ppm") == 0 && i + 1 < argc)
+			ppmPath = argv[++i];
+		else if (strcmp(argv[i], "-scale") == 0 && i + 1 < argc)
+			scale = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-text") == 0 && i + 1 < argc)
+			textPath = argv[++i];
+		else if (argv[i][0] == '+')
+			hostRun(atol(argv[i] + 1));
+		else
+			hostCommand(argv[i]);
+	}
+
+	hostRun(runMillis);
+
+	fputs(hostSerialOutput.c_str(), stderr);
+
+	if (ppmPath == NULL && textPath == NULL)
+		textPath = "-";
+
+	if (textPath != NULL)
+	{
+		std::string text = hostFramesText(hostFrames);
+
+		if (strcmp(textPath, "-") == 0)
+		{
+			fputs(text.c_str(), stdout);
+		}
+		else
+		{
+			FILE * file = fopen(textPath, "w");
+			if (file == NULL)
+			{
+				fprintf(stderr, "Cannot write %s\n", textPath);
+				return 1;
+			}
+			fputs(text.c_str(), file);
+			fclose(file);
+		}
+	}
+
+	if (ppmPath != NULL && !hostWriteFramesPpm(ppmPath, hostFrames, scale))
+	{
+		fprintf(stderr, "Cannot write %s\n", ppmPath);
+		return 1;
+	}
+
+	fprintf(stderr, "%lu frames over %lu ms\n", (unsigned long)hostFrames.size(), millis());
+	return 0;
+}